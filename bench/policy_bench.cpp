@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2006-2024, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Placement policy benchmark: runs the same random workloads on a heap of
+ * every policy and reports the speed and the fragmentation left behind.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <small_mem/inc/smem.h>
+#include <small_mem/inc/smem_port.h>
+
+#define BENCH_HEAP_SIZE (4 * 1024 * 1024)
+#define BENCH_SLOTS     (4096)
+#define BENCH_OPS       (1000000)
+
+struct bench_policy
+{
+    enum smem_policy policy;
+    const char *name;
+};
+
+struct bench_workload
+{
+    const char *name;
+    size_t min_size;
+    size_t max_size;
+    unsigned large_permille; /* share of requests drawn from [max_size, 16 * max_size) */
+};
+
+struct bench_result
+{
+    double mops;          /* million alloc and free operations per second */
+    size_t failed;        /* allocations which returned NULL */
+    size_t free_total;    /* free bytes left in the heap */
+    size_t free_largest;  /* largest free block */
+    size_t free_blocks;   /* number of free blocks */
+};
+
+static const struct bench_policy policies[] = {
+    {SMEM_POLICY_SEGREGATED, "segregated"},
+    {SMEM_POLICY_TLSF, "tlsf"},
+    {SMEM_POLICY_BITMAP, "bitmap"},
+    {SMEM_POLICY_FIRST_FIT, "first-fit"},
+    {SMEM_POLICY_NEXT_FIT, "next-fit"},
+    {SMEM_POLICY_BEST_FIT, "best-fit"},
+    {SMEM_POLICY_GOOD_FIT, "good-fit"},
+};
+
+static const struct bench_workload workloads[] = {
+    {"small", 8, 128, 0},
+    {"mixed", 16, 512, 20},
+    {"large", 256, 4096, 50},
+};
+
+static int bench_block(const struct smem_block *block, void *ctx)
+{
+    struct bench_result *result = (struct bench_result *)ctx;
+
+    if (!block->used)
+    {
+        result->free_total += block->size;
+        result->free_blocks++;
+        if (block->size > result->free_largest)
+            result->free_largest = block->size;
+    }
+    return 0;
+}
+
+static void bench_walk(struct small_mem *heap, struct bench_result *result)
+{
+    /* blocks cached by this thread or waiting on the quick lists are not visible in the heap */
+    smem_tcache_flush();
+#if SMEM_USING_QUICK_LIST
+    smem_coalesce(heap);
+#endif
+    result->free_total = 0;
+    result->free_largest = 0;
+    result->free_blocks = 0;
+    smem_walk(heap, bench_block, result);
+}
+
+static void bench_run(void *buf, const struct bench_policy *policy, const struct bench_workload *workload,
+                      struct bench_result *result)
+{
+    std::mt19937 rng(20211014);
+    std::vector<void *> slots(BENCH_SLOTS, nullptr);
+    struct small_mem *heap;
+    size_t i, idx, size;
+
+    heap = (struct small_mem *)smem_init_ex(buf, BENCH_HEAP_SIZE, policy->policy);
+    memset(result, 0, sizeof(*result));
+
+    auto begin = std::chrono::steady_clock::now();
+    for (i = 0; i < BENCH_OPS; i++)
+    {
+        idx = rng() % BENCH_SLOTS;
+        if (slots[idx] != nullptr)
+        {
+            smem_free(slots[idx]);
+            slots[idx] = nullptr;
+            continue;
+        }
+
+        if (rng() % 1000 < workload->large_permille)
+            size = workload->max_size + rng() % (workload->max_size * 15);
+        else
+            size = workload->min_size + rng() % (workload->max_size - workload->min_size + 1);
+        slots[idx] = smem_alloc(heap, size);
+        if (slots[idx] == nullptr)
+            result->failed++;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    /* fragmentation is measured with the live blocks of the steady state */
+    bench_walk(heap, result);
+    result->mops = BENCH_OPS / std::chrono::duration<double, std::micro>(end - begin).count();
+
+    for (idx = 0; idx < BENCH_SLOTS; idx++)
+    {
+        if (slots[idx] != nullptr)
+            smem_free(slots[idx]);
+    }
+    smem_tcache_flush();
+    smem_deinit(heap);
+}
+
+int main(void)
+{
+    struct bench_result result;
+    void *buf;
+    size_t w, p;
+
+    buf = malloc(BENCH_HEAP_SIZE);
+    if (buf == NULL)
+        return 1;
+
+    printf("%-8s %-11s %10s %8s %12s %12s %8s %6s\n", "workload", "policy", "Mops/s", "failed", "free", "largest",
+           "blocks", "frag");
+    for (w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++)
+    {
+        for (p = 0; p < sizeof(policies) / sizeof(policies[0]); p++)
+        {
+            bench_run(buf, &policies[p], &workloads[w], &result);
+            /* share of the free memory which is not usable by the largest request */
+            printf("%-8s %-11s %10.2f %8zu %12zu %12zu %8zu %5.1f%%\n", workloads[w].name, policies[p].name,
+                   result.mops, result.failed, result.free_total, result.free_largest, result.free_blocks,
+                   result.free_total ? 100.0 * (1.0 - (double)result.free_largest / result.free_total) : 0.0);
+        }
+    }
+
+    free(buf);
+
+    return 0;
+}
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2006-2024, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Allocator benchmark: alloc and free throughput and latency percentiles of
+ * small_mem and glibc malloc on the same workloads, across size
+ * distributions, heap sizes, fill levels and aged (fragmented) heaps.
+ *
+ * Every timed iteration frees a random live block and allocates a new one
+ * in its place, so the fill level stays where the setup left it.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <small_mem/inc/smem.h>
+#include <small_mem/inc/smem_port.h>
+
+#define BENCH_MIN_SLOTS    (64)      /* live blocks churned when the heap is not filled */
+#define BENCH_SAMPLES      (1 << 18) /* latency samples kept per operation */
+#define BENCH_STREAM       (1 << 16) /* pre-generated sizes and slot indexes */
+#define BENCH_AGING_ROUNDS (4)       /* replacements per live block run by the aging pass */
+
+enum bench_dist
+{
+    BENCH_DIST_SMALL = 0, /* uniform [16, 128] */
+    BENCH_DIST_MEDIUM,    /* uniform [128, 4096] */
+    BENCH_DIST_MIXED,     /* 90% small, 9% up to 4 KB, 1% up to 64 KB */
+};
+
+static const char *const bench_dist_name[] = {"small", "medium", "mixed"};
+
+static size_t bench_size(std::mt19937 &rng, int dist)
+{
+    unsigned pick;
+
+    switch (dist)
+    {
+    case BENCH_DIST_SMALL:
+        return 16 + rng() % 113;
+    case BENCH_DIST_MEDIUM:
+        return 128 + rng() % 3969;
+    default:
+        pick = rng() % 100;
+        if (pick < 90)
+            return 16 + rng() % 113;
+        if (pick < 99)
+            return 128 + rng() % 3969;
+        return 4096 + rng() % 61441;
+    }
+}
+
+/* a small_mem heap of the given policy placed in a malloc'ed buffer */
+template <enum smem_policy Policy>
+class bench_smem
+{
+public:
+    explicit bench_smem(size_t size)
+    {
+        buf_ = malloc(size);
+        heap_ = buf_ != nullptr ? smem_init_ex(buf_, size, Policy) : nullptr;
+    }
+
+    ~bench_smem()
+    {
+        smem_tcache_flush();
+        if (heap_ != nullptr)
+            smem_deinit(heap_);
+        free(buf_);
+    }
+
+    bool valid(void) const
+    {
+        return heap_ != nullptr;
+    }
+
+    void *alloc(size_t size)
+    {
+        return smem_alloc(heap_, size);
+    }
+
+    void release(void *ptr)
+    {
+        smem_free(ptr);
+    }
+
+private:
+    void *buf_;
+    smem_t heap_;
+};
+
+/* glibc malloc, the heap size only sets the fill target */
+class bench_malloc
+{
+public:
+    explicit bench_malloc(size_t size)
+    {
+        (void)size;
+    }
+
+    bool valid(void) const
+    {
+        return true;
+    }
+
+    void *alloc(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void release(void *ptr)
+    {
+        free(ptr);
+    }
+};
+
+static double bench_percentile(std::vector<uint32_t> &samples, size_t count, double p)
+{
+    size_t n;
+
+    if (count == 0)
+        return 0;
+
+    n = (size_t)(p * (count - 1));
+    std::nth_element(samples.begin(), samples.begin() + n, samples.begin() + count);
+    return samples[n];
+}
+
+/*
+ * Arguments: size distribution, heap size, fill level in percent of the heap
+ * and 1 to age the heap with mixed replacements before the timed loop.
+ */
+template <class Allocator>
+static void BM_churn(benchmark::State &state)
+{
+    int dist = (int)state.range(0);
+    size_t heap_size = (size_t)state.range(1);
+    size_t fill = heap_size / 100 * (size_t)state.range(2);
+    bool aged = state.range(3) != 0;
+    std::mt19937 rng(20211014);
+    std::vector<void *> slots;
+    std::vector<size_t> sizes(BENCH_STREAM);
+    std::vector<uint32_t> indexes(BENCH_STREAM);
+    std::vector<uint32_t> alloc_ns(BENCH_SAMPLES), free_ns(BENCH_SAMPLES);
+    size_t filled = 0, size, i, samples = 0, failed = 0;
+    Allocator allocator(heap_size);
+    void *ptr;
+
+    if (!allocator.valid())
+    {
+        state.SkipWithError("heap setup failed");
+        return;
+    }
+
+    /* fill the heap, keep a few live blocks to churn on an empty heap */
+    while (filled < fill || slots.size() < BENCH_MIN_SLOTS)
+    {
+        size = bench_size(rng, dist);
+        ptr = allocator.alloc(size);
+        if (ptr == nullptr)
+            break;
+        slots.push_back(ptr);
+        filled += size;
+    }
+    if (slots.empty())
+    {
+        state.SkipWithError("heap too small for the distribution");
+        return;
+    }
+
+    if (aged)
+    {
+        for (i = 0; i < slots.size() * BENCH_AGING_ROUNDS; i++)
+        {
+            size_t idx = rng() % slots.size();
+
+            if (slots[idx] != nullptr)
+                allocator.release(slots[idx]);
+            slots[idx] = allocator.alloc(bench_size(rng, BENCH_DIST_MIXED));
+        }
+    }
+
+    for (i = 0; i < BENCH_STREAM; i++)
+    {
+        sizes[i] = bench_size(rng, dist);
+        indexes[i] = (uint32_t)(rng() % slots.size());
+    }
+
+    i = 0;
+    for (auto _ : state)
+    {
+        void *&slot = slots[indexes[i % BENCH_STREAM]];
+        auto begin = std::chrono::steady_clock::now();
+        allocator.release(slot);
+        auto middle = std::chrono::steady_clock::now();
+        slot = allocator.alloc(sizes[i % BENCH_STREAM]);
+        auto end = std::chrono::steady_clock::now();
+
+        if (slot == nullptr)
+            failed++;
+        free_ns[samples] = (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(middle - begin).count();
+        alloc_ns[samples] = (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - middle).count();
+        if (++samples == BENCH_SAMPLES)
+            samples = 0;
+        i++;
+    }
+
+    if (i > BENCH_SAMPLES)
+        samples = BENCH_SAMPLES;
+    state.SetItemsProcessed((int64_t)state.iterations() * 2);
+    state.counters["live"] = (double)slots.size();
+    state.counters["failed"] = (double)failed;
+    state.counters["alloc_p50_ns"] = bench_percentile(alloc_ns, samples, 0.50);
+    state.counters["alloc_p99_ns"] = bench_percentile(alloc_ns, samples, 0.99);
+    state.counters["alloc_p999_ns"] = bench_percentile(alloc_ns, samples, 0.999);
+    state.counters["free_p50_ns"] = bench_percentile(free_ns, samples, 0.50);
+    state.counters["free_p99_ns"] = bench_percentile(free_ns, samples, 0.99);
+    state.SetLabel(std::string(bench_dist_name[dist]) + (aged ? "/aged" : "/fresh"));
+
+    for (void *slot : slots)
+    {
+        if (slot != nullptr)
+            allocator.release(slot);
+    }
+}
+
+static void bench_args(benchmark::internal::Benchmark *b)
+{
+    static const int64_t heaps[] = {64 << 10, 1 << 20, 64 << 20};
+    static const int64_t fills[] = {0, 50, 90};
+    int64_t dist, aged;
+
+    b->ArgNames({"dist", "heap", "fill", "aged"});
+    for (dist = BENCH_DIST_SMALL; dist <= BENCH_DIST_MIXED; dist++)
+    {
+        for (int64_t heap : heaps)
+        {
+            for (int64_t fill : fills)
+            {
+                for (aged = 0; aged <= 1; aged++)
+                    b->Args({dist, heap, fill, aged});
+            }
+        }
+        /* a huge mostly empty heap, the free block search spans the whole of it */
+        b->Args({dist, (int64_t)1 << 30, 0, 0});
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_churn, bench_smem<SMEM_POLICY_SEGREGATED>)->Apply(bench_args);
+BENCHMARK_TEMPLATE(BM_churn, bench_smem<SMEM_POLICY_TLSF>)->Apply(bench_args);
+BENCHMARK_TEMPLATE(BM_churn, bench_smem<SMEM_POLICY_FIRST_FIT>)->Apply(bench_args);
+BENCHMARK_TEMPLATE(BM_churn, bench_malloc)->Apply(bench_args);
+
+BENCHMARK_MAIN();
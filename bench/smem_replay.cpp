@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2006-2024, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Trace replay: runs the operations of a trace written by smem_trace_start
+ * against a fresh heap and reports the time, the peak usage and the
+ * fragmentation.
+ *
+ * usage: smem_replay <trace> [heap size in bytes] [policy]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#include <small_mem/inc/smem.h>
+#include <small_mem/inc/smem_trace.h>
+
+#define REPLAY_HEAP_SIZE (64 * 1024 * 1024)
+#define REPLAY_SAMPLE    (4096) /* operations between two fragmentation samples */
+
+struct replay_policy
+{
+    enum smem_policy policy;
+    const char *name;
+};
+
+struct replay_frag
+{
+    size_t free_total;
+    size_t free_largest;
+};
+
+static const struct replay_policy policies[] = {
+    {SMEM_POLICY_SEGREGATED, "segregated"},
+    {SMEM_POLICY_TLSF, "tlsf"},
+    {SMEM_POLICY_BITMAP, "bitmap"},
+    {SMEM_POLICY_FIRST_FIT, "first-fit"},
+    {SMEM_POLICY_NEXT_FIT, "next-fit"},
+    {SMEM_POLICY_BEST_FIT, "best-fit"},
+    {SMEM_POLICY_GOOD_FIT, "good-fit"},
+};
+
+static int replay_block(const struct smem_block *block, void *ctx)
+{
+    struct replay_frag *frag = (struct replay_frag *)ctx;
+
+    if (!block->used)
+    {
+        frag->free_total += block->size;
+        if (block->size > frag->free_largest)
+            frag->free_largest = block->size;
+    }
+    return 0;
+}
+
+/* share of the free memory outside the largest free block, in percent */
+static double replay_frag(smem_t heap)
+{
+    struct replay_frag frag = {0, 0};
+
+    smem_tcache_flush();
+#if SMEM_USING_QUICK_LIST
+    smem_coalesce(heap);
+#endif
+    smem_walk(heap, replay_block, &frag);
+    if (frag.free_total == 0)
+        return 0;
+    return 100.0 * (1.0 - (double)frag.free_largest / frag.free_total);
+}
+
+static int replay_load(const char *path, std::vector<struct smem_trace_record> &records, uint32_t *dropped)
+{
+    struct smem_trace_header header;
+    FILE *file;
+    int ok;
+
+    file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "can not open %s\n", path);
+        return -1;
+    }
+
+    ok = fread(&header, sizeof(header), 1, file) == 1;
+    if (ok && header.magic == SMEM_TRACE_MAGIC_OPEN)
+    {
+        fprintf(stderr, "the recording of %s was not stopped\n", path);
+        fclose(file);
+        return -1;
+    }
+    ok = ok && header.magic == SMEM_TRACE_MAGIC && header.version == SMEM_TRACE_VERSION &&
+         header.record_size == sizeof(struct smem_trace_record);
+    if (ok)
+    {
+        records.resize((size_t)header.count);
+        ok = fread(records.data(), sizeof(struct smem_trace_record), records.size(), file) == records.size();
+    }
+    fclose(file);
+    if (!ok)
+    {
+        fprintf(stderr, "%s is not a complete trace\n", path);
+        return -1;
+    }
+
+    *dropped = header.dropped;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<struct smem_trace_record> records;
+    std::unordered_map<uint32_t, void *> blocks;
+    std::chrono::steady_clock::duration elapsed(0);
+    const struct replay_policy *policy = &policies[0];
+    size_t heap_size = REPLAY_HEAP_SIZE, i, failed = 0, missing = 0;
+    double frag, frag_max = 0;
+    uint64_t cycles = 0;
+    uint32_t dropped;
+    smem_t heap;
+    void *buf, *ptr, *old;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <trace> [heap size in bytes] [policy]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 2)
+        heap_size = (size_t)strtoull(argv[2], NULL, 0);
+    if (argc > 3)
+    {
+        for (i = 0; i < sizeof(policies) / sizeof(policies[0]); i++)
+        {
+            if (strcmp(argv[3], policies[i].name) == 0)
+                break;
+        }
+        if (i == sizeof(policies) / sizeof(policies[0]))
+        {
+            fprintf(stderr, "unknown policy %s\n", argv[3]);
+            return 1;
+        }
+        policy = &policies[i];
+    }
+
+    if (replay_load(argv[1], records, &dropped) != 0)
+        return 1;
+
+    buf = malloc(heap_size);
+    heap = buf != NULL ? smem_init_ex(buf, heap_size, policy->policy) : NULL;
+    if (heap == NULL)
+    {
+        fprintf(stderr, "can not create a heap of %zu bytes\n", heap_size);
+        free(buf);
+        return 1;
+    }
+
+    for (i = 0; i < records.size(); i++)
+    {
+        const struct smem_trace_record &record = records[i];
+        /* a realloc to size 0 released the block as well */
+        bool release = record.op == SMEM_TRACE_FREE || (record.old_id != 0 && record.size == 0 && record.id == 0);
+        bool resize = record.op == SMEM_TRACE_EXPAND || record.op == SMEM_TRACE_SHRINK;
+
+        cycles += record.delta;
+        old = nullptr;
+        if (record.old_id != 0)
+        {
+            auto it = blocks.find(record.old_id);
+            if (it != blocks.end())
+            {
+                old = it->second;
+                blocks.erase(it);
+            }
+            else
+            {
+                /* the block was allocated before the trace started */
+                missing++;
+            }
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        if (record.old_id == 0)
+        {
+            ptr = record.align != 0 ? smem_memalign(heap, record.align, record.size) : smem_alloc(heap, record.size);
+        }
+        else if (release)
+        {
+            smem_free(old);
+            ptr = nullptr;
+        }
+        else if (resize && old != nullptr)
+        {
+            /* the block keeps its address, an expand which falls short failed */
+            if (record.op == SMEM_TRACE_EXPAND)
+                failed += smem_try_expand(heap, old, record.size) < record.size;
+            else
+                (void)smem_try_shrink(heap, old, record.size);
+            ptr = old;
+        }
+        else
+        {
+            ptr = old != nullptr ? smem_realloc(heap, old, record.size) : smem_alloc(heap, record.size);
+        }
+        elapsed += std::chrono::steady_clock::now() - begin;
+
+        if (!release)
+        {
+            if (ptr == nullptr && record.size != 0)
+                failed++;
+
+            /* a failed realloc leaves the old block live, in the trace or in the replay */
+            if (ptr == nullptr)
+                ptr = old;
+            if (record.id != 0 || record.old_id != 0)
+            {
+                if (ptr != nullptr)
+                    blocks[record.id != 0 ? record.id : record.old_id] = ptr;
+            }
+            else if (ptr != nullptr)
+            {
+                /* the allocation failed while recording, nobody holds the block */
+                smem_free(ptr);
+            }
+        }
+
+        if ((i + 1) % REPLAY_SAMPLE == 0)
+        {
+            frag = replay_frag(heap);
+            if (frag > frag_max)
+                frag_max = frag;
+        }
+    }
+
+    frag = replay_frag(heap);
+    if (frag > frag_max)
+        frag_max = frag;
+
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    printf("trace        %s\n", argv[1]);
+    printf("policy       %s\n", policy->name);
+    printf("heap         %zu bytes\n", (size_t)heap->parent.total);
+    printf("operations   %zu (%u dropped while recording)\n", records.size(), dropped);
+    printf("trace time   %llu cycles\n", (unsigned long long)cycles);
+    printf("replay time  %.3f ms, %.1f ns/op\n", ns / 1e6, records.empty() ? 0.0 : (double)ns / records.size());
+    printf("failed       %zu allocations and expands\n", failed);
+    printf("unknown      %zu blocks allocated before the trace\n", missing);
+    printf("peak usage   %zu bytes\n", (size_t)heap->parent.max);
+    printf("final usage  %zu bytes in %zu blocks\n", (size_t)heap->parent.used, blocks.size());
+    printf("frag         %.1f%% final, %.1f%% worst sampled\n", frag, frag_max);
+
+    for (auto &block : blocks)
+        smem_free(block.second);
+    smem_tcache_flush();
+    smem_deinit(heap);
+    free(buf);
+
+    return 0;
+}
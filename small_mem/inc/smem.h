@@ -7,6 +7,7 @@ extern "C" {
 
 #include <stdint.h>
 #include <stddef.h>
+#include "smem_port.h"
 
 /**
  * @def SMEM_ALIGN(size, align)
@@ -30,7 +31,7 @@ extern "C" {
  */
 struct memory
 {
-    uint32_t address; /**< memory start address */
+    uintptr_t address; /**< memory start address */
     size_t total;     /**< memory size */
     size_t used;      /**< size used */
     size_t max;       /**< maximum usage */
@@ -38,9 +39,154 @@ struct memory
 
 struct small_mem_item
 {
+#if SMEM_USING_COMPACT_HEADER
+    uint32_t next;      /**< next item */
+    uint32_t prev;      /**< prev item, bit 0 marks a used item */
+#else
     uintptr_t pool_ptr; /**< small memory object addr */
     size_t next;        /**< next free item */
     size_t prev;        /**< prev free item */
+#endif
+};
+
+#if SMEM_USING_STATS
+/**
+ * Cumulative operation counters of a small memory object
+ */
+struct smem_counters
+{
+    size_t alloc_count;     /**< blocks allocated */
+    size_t free_count;      /**< blocks released */
+    size_t realloc_count;   /**< blocks resized by smem_realloc */
+    size_t realloc_inplace; /**< resizes which kept the block address */
+    size_t realloc_moved;   /**< resizes which moved the block */
+    size_t failed_count;    /**< allocations and resizes which ran out of memory */
+    size_t searches;        /**< free block searches */
+    size_t search_steps;    /**< free blocks visited by the searches */
+};
+
+/**
+ * Runtime statistics of a small memory object, see smem_get_stats
+ */
+struct smem_stats
+{
+    size_t total;           /**< memory size */
+    size_t used;            /**< size used, headers included */
+    size_t max;             /**< maximum usage */
+    size_t live_blocks;     /**< number of used blocks */
+    size_t free_blocks;     /**< number of free blocks */
+    size_t free_size;       /**< sum of the free block sizes */
+    size_t largest_free;    /**< size of the largest free block */
+    uint32_t fragmentation; /**< share of free_size outside the largest free block, in per mille */
+    struct smem_counters counters; /**< cumulative operation counters */
+};
+#endif
+
+/**
+ * Block reported by smem_walk
+ */
+struct smem_block
+{
+    void *ptr;       /**< user data of the block */
+    size_t offset;   /**< offset of the block header from the beginning of its area */
+    size_t size;     /**< usable size of the block */
+    uint32_t area;   /**< 0 for the initial heap, n for the n-th added region */
+    uint32_t used;   /**< 1 for a used block, 0 for a free block */
+};
+
+/* returns non-zero to stop the walk */
+typedef int (*smem_walk_t)(const struct smem_block *block, void *ctx);
+
+/**
+ * Header of the block map written by smem_dump, followed by count records
+ */
+struct smem_dump_header
+{
+    uint32_t magic;   /**< SMEM_DUMP_MAGIC */
+    uint16_t version; /**< SMEM_DUMP_VERSION */
+    uint16_t align;   /**< granule size of the records in bytes */
+    uint32_t count;   /**< number of records */
+    uint32_t areas;   /**< number of areas, the initial heap and the added regions */
+};
+
+/**
+ * Block of the map written by smem_dump, offsets and sizes count granules
+ */
+struct smem_dump_record
+{
+    uint32_t offset;  /**< offset of the block header from the beginning of its area */
+    uint32_t info;    /**< usable size << 1 | SMEM_DUMP_USED, a record of offset 0 begins the next area */
+};
+
+#define SMEM_DUMP_MAGIC   (0x504d4453) /* "SDMP" */
+#define SMEM_DUMP_VERSION (1)
+#define SMEM_DUMP_USED    (0x1)        /* the block is used */
+
+#if SMEM_USING_HOOK
+struct small_mem;
+
+/**
+ * Operation reported to the hooks of a small memory object
+ */
+enum smem_hook_op
+{
+    SMEM_HOOK_ALLOC = 0, /**< smem_alloc, smem_memalign, smem_aligned_alloc and every block of smem_alloc_batch */
+    SMEM_HOOK_REALLOC,   /**< smem_realloc */
+    SMEM_HOOK_FREE,      /**< smem_free and every block of smem_free_batch */
+    SMEM_HOOK_EXPAND,    /**< smem_try_expand, ptr and old_ptr are the block, which keeps its address */
+    SMEM_HOOK_SHRINK,    /**< smem_try_shrink, ptr and old_ptr are the block, which keeps its address */
+    SMEM_HOOK_MOVE,      /**< smem_compact moved a handle block from old_ptr to ptr, post hook only, under the heap lock */
+};
+
+/**
+ * Operation passed to the hooks of a small memory object, see smem_set_hooks
+ */
+struct smem_hook_info
+{
+    enum smem_hook_op op; /**< operation */
+    void *ptr;            /**< block returned by alloc and realloc, set in the post hook only, or block released by free */
+    void *old_ptr;        /**< block passed to realloc */
+    size_t size;          /**< requested size, the usable size of the block for free */
+    size_t rounded;       /**< requested size rounded up by the heap, the usable size of ptr in the post hook */
+    size_t align;         /**< alignment requested by smem_memalign, 0 for the other operations */
+    uint64_t cycles;      /**< duration of the operation in SMEM_HOOK_CYCLES units, set in the post hook only */
+    uint64_t seq;         /**< order of the operation among those of the heap, set in the post hook only */
+};
+
+typedef void (*smem_hook_t)(struct small_mem *m, const struct smem_hook_info *info, void *tag);
+#endif
+
+/**
+ * Free block placement policy of a small memory object
+ */
+enum smem_policy
+{
+    SMEM_POLICY_SEGREGATED = 0, /**< segregated fit over power-of-two size classes */
+    SMEM_POLICY_TLSF,           /**< two-level segregated fit, O(1) allocation and release */
+    SMEM_POLICY_BITMAP,         /**< first fit by scanning a bitmap of the free granules of the heap */
+    SMEM_POLICY_FIRST_FIT,      /**< first fit over a single address-ordered free list */
+    SMEM_POLICY_NEXT_FIT,       /**< first fit from where the previous search stopped */
+    SMEM_POLICY_BEST_FIT,       /**< smallest fitting block of the address-ordered free list */
+    SMEM_POLICY_GOOD_FIT,       /**< smallest of the first SMEM_GOOD_FIT_COUNT fitting blocks */
+};
+
+struct small_mem_tlsf;
+struct small_mem_bitmap;
+
+/* handle of a block the heap may move, see smem_halloc */
+struct smem_handle;
+typedef struct smem_handle *smem_handle_t;
+
+/**
+ * Descriptor of a memory region added by smem_add_region, it is placed at
+ * the beginning of the region and followed by the items of the region
+ */
+struct small_mem_region
+{
+    struct small_mem_region *next; /**< next added region */
+    struct small_mem_item *end;    /**< end item of the region */
+    void *base;                    /**< address returned by the grow callback */
+    size_t size;                   /**< size mapped by the grow callback, 0 for a region added by the user */
 };
 
 /**
@@ -51,15 +197,83 @@ struct small_mem
     struct memory parent; /**< inherit from memory */
     uint8_t *heap_ptr;    /**< pointer to the heap */
     struct small_mem_item *heap_end;
-    struct small_mem_item *lfree;
+    struct small_mem_item *lfree; /**< lowest free item hint, no free item lies below it */
     size_t mem_size_aligned; /**< aligned memory size */
+    size_t region_max;       /**< aligned size of the largest region */
+    struct small_mem_region *regions; /**< regions added after init */
+    smem_grow_t grow;        /**< maps a new region when the heap runs out of memory */
+    smem_trim_t trim;        /**< unmaps a region mapped by grow */
+    void *provider_arg;      /**< argument of grow and trim */
+    enum smem_policy policy; /**< free block placement policy */
+    struct small_mem_tlsf *tlsf; /**< TLSF index, only used by SMEM_POLICY_TLSF */
+    struct small_mem_item *rover; /**< free item the next search starts from, only used by SMEM_POLICY_NEXT_FIT */
+    struct small_mem_bitmap *bitmap; /**< granule bitmap, only used by SMEM_POLICY_BITMAP */
+    struct smem_handle *handle_free; /**< unused handles */
+    struct small_mem_item *compact; /**< used item the next smem_compact step starts from */
+    uint32_t free_bitmap;    /**< bit n is set when free_list[n] is not empty */
+    struct small_mem_item *free_list[SMEM_FREE_LIST_NUM]; /**< segregated free lists, free_list[0] heads the address-ordered list */
+#if SMEM_USING_STATS
+    struct smem_counters stats; /**< cumulative operation counters */
+#endif
+#if SMEM_USING_QUICK_LIST
+    struct small_mem_item *quick[SMEM_QUICK_MAX_SIZE / SMEM_ALIGN_SIZE]; /**< list n holds unmerged freed blocks of (n + 1) * SMEM_ALIGN_SIZE */
+    size_t quick_count; /**< number of blocks on the quick lists */
+#endif
+#if SMEM_USING_HOOK
+    smem_hook_t hook_pre;  /**< called before an operation */
+    smem_hook_t hook_post; /**< called after an operation */
+    void *hook_tag;        /**< tag passed to the hooks */
+    uint64_t hook_seq;     /**< number of the next operation reported to the post hook */
+#endif
+#if SMEM_USING_THREAD_SAFE
+    SMEM_LOCK_T lock; /**< lock of the heap */
+    uint32_t serial;  /**< unique serial of the heap, checked by the per-thread caches */
+#endif
+#if SMEM_USING_REMOTE_FREE
+    const void *owner;             /**< thread which frees into the heap directly, see smem_set_owner */
+    struct small_mem_item *remote; /**< blocks freed by other threads, linked through their data */
+#endif
 };
 typedef struct small_mem *smem_t;
 
 smem_t smem_init(void *begin_addr, size_t size);
+smem_t smem_init_ex(void *begin_addr, size_t size, enum smem_policy policy);
+void smem_deinit(smem_t m);
+int smem_add_region(smem_t m, void *begin_addr, size_t size);
+void smem_set_provider(smem_t m, smem_grow_t grow, smem_trim_t trim, void *arg);
+size_t smem_trim(smem_t m);
 void *smem_alloc(smem_t m, size_t size);
+void *smem_memalign(smem_t m, size_t align, size_t size);
+void *smem_aligned_alloc(smem_t m, size_t align, size_t size);
+size_t smem_alloc_batch(smem_t m, size_t size, size_t n, void **out);
 void *smem_realloc(smem_t m, void *rmem, size_t newsize);
+size_t smem_try_expand(smem_t m, void *rmem, size_t newsize);
+size_t smem_try_shrink(smem_t m, void *rmem, size_t newsize);
 void smem_free(void *rmem);
+void smem_free_batch(void **ptrs, size_t n);
+smem_handle_t smem_halloc(smem_t m, size_t size);
+void *smem_hlock(smem_handle_t h);
+void smem_hunlock(smem_handle_t h);
+void smem_hfree(smem_handle_t h);
+size_t smem_compact(smem_t m, size_t budget);
+smem_t smem_owner(void *rmem);
+size_t smem_usable_size(void *rmem);
+void smem_tcache_flush(void);
+size_t smem_walk(smem_t m, smem_walk_t walk, void *ctx);
+size_t smem_dump(smem_t m, void *buf, size_t size);
+#if SMEM_USING_STATS
+void smem_get_stats(smem_t m, struct smem_stats *stats);
+#endif
+#if SMEM_USING_QUICK_LIST
+size_t smem_coalesce(smem_t m);
+#endif
+#if SMEM_USING_REMOTE_FREE
+void smem_set_owner(smem_t m);
+size_t smem_remote_drain(smem_t m);
+#endif
+#if SMEM_USING_HOOK
+void smem_set_hooks(smem_t m, smem_hook_t pre, smem_hook_t post, void *tag);
+#endif
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,144 @@
+#ifndef __SMEM_HPP
+#define __SMEM_HPP
+
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+
+#include "smem.h"
+#include "smem_port.h"
+
+namespace smem
+{
+
+/**
+ * std::pmr::memory_resource on a small_mem heap, pmr containers place their
+ * memory in the heap. The resource does not own the heap.
+ */
+class memory_resource : public std::pmr::memory_resource
+{
+public:
+    explicit memory_resource(smem_t heap) noexcept : heap_(heap)
+    {
+        _ASSERT(heap != nullptr);
+    }
+
+    smem_t heap(void) const noexcept
+    {
+        return heap_;
+    }
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        void *ptr;
+
+        /* a zero sized request still gets a distinct block */
+        if (bytes == 0)
+            bytes = 1;
+        if (alignment <= SMEM_ALIGN_SIZE)
+            ptr = smem_alloc(heap_, bytes);
+        else
+            ptr = smem_memalign(heap_, alignment, bytes);
+        if (ptr == nullptr)
+            throw std::bad_alloc();
+
+        return ptr;
+    }
+
+    void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override
+    {
+        (void)alignment;
+        /* the block knows its size, the given one is only checked */
+        _ASSERT(smem_usable_size(ptr) >= bytes);
+        (void)bytes;
+        smem_free(ptr);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        const memory_resource *resource = dynamic_cast<const memory_resource *>(&other);
+
+        /* blocks of a heap may be released through any resource of the heap */
+        return resource != nullptr && resource->heap_ == heap_;
+    }
+
+    smem_t heap_;
+};
+
+/**
+ * Allocator of the standard containers on a small_mem heap, copies and
+ * rebinds share the heap.
+ */
+template <class T>
+class allocator
+{
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    explicit allocator(smem_t heap) noexcept : heap_(heap)
+    {
+        _ASSERT(heap != nullptr);
+    }
+
+    template <class U>
+    allocator(const allocator<U> &other) noexcept : heap_(other.heap())
+    {
+    }
+
+    T *allocate(std::size_t n)
+    {
+        std::size_t bytes;
+        void *ptr;
+
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            throw std::bad_array_new_length();
+
+        /* a zero sized request still gets a distinct block */
+        bytes = n != 0 ? n * sizeof(T) : 1;
+        if (alignof(T) <= SMEM_ALIGN_SIZE)
+            ptr = smem_alloc(heap_, bytes);
+        else
+            ptr = smem_memalign(heap_, alignof(T), bytes);
+        if (ptr == nullptr)
+            throw std::bad_alloc();
+
+        return static_cast<T *>(ptr);
+    }
+
+    void deallocate(T *ptr, std::size_t n) noexcept
+    {
+        _ASSERT(smem_usable_size(ptr) >= n * sizeof(T));
+        (void)n;
+        smem_free(ptr);
+    }
+
+    smem_t heap(void) const noexcept
+    {
+        return heap_;
+    }
+
+private:
+    smem_t heap_;
+};
+
+template <class T, class U>
+bool operator==(const allocator<T> &a, const allocator<U> &b) noexcept
+{
+    return a.heap() == b.heap();
+}
+
+template <class T, class U>
+bool operator!=(const allocator<T> &a, const allocator<U> &b) noexcept
+{
+    return a.heap() != b.heap();
+}
+
+} /* namespace smem */
+
+#endif /* __SMEM_HPP */
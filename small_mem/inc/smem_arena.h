@@ -0,0 +1,47 @@
+#ifndef __SMEM_ARENA_H
+#define __SMEM_ARENA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "smem.h"
+
+struct small_mem_arena_chunk;
+
+/**
+ * Bump-pointer arena, memory is carved from chunks allocated in a heap and
+ * released all at once. An arena is not locked, use one per thread.
+ */
+struct small_mem_arena
+{
+    smem_t heap;                         /**< heap the chunks come from */
+    size_t chunk_size;                   /**< payload size of a regular chunk */
+    struct small_mem_arena_chunk *chunk; /**< newest chunk, chunks link to older ones */
+    uint8_t *ptr;                        /**< next free byte of the newest chunk */
+    uint8_t *end;                        /**< end of the newest chunk */
+};
+typedef struct small_mem_arena *smem_arena_t;
+
+/**
+ * Checkpoint of an arena, see smem_arena_mark
+ */
+struct smem_arena_mark
+{
+    struct small_mem_arena_chunk *chunk; /**< newest chunk when marked */
+    uint8_t *ptr;                        /**< bump pointer when marked */
+};
+typedef struct smem_arena_mark smem_arena_mark_t;
+
+smem_arena_t smem_arena_create(smem_t heap, size_t chunk_size);
+void smem_arena_destroy(smem_arena_t arena);
+void *smem_arena_alloc(smem_arena_t arena, size_t size);
+smem_arena_mark_t smem_arena_mark(smem_arena_t arena);
+void smem_arena_rollback(smem_arena_t arena, smem_arena_mark_t mark);
+void smem_arena_reset(smem_arena_t arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SMEM_ARENA_H */
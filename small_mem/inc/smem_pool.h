@@ -0,0 +1,56 @@
+#ifndef __SMEM_POOL_H
+#define __SMEM_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "smem.h"
+
+struct small_mem_slab;
+
+/**
+ * Fixed-size object pool, objects are carved from slabs allocated in a heap
+ * and carry no header of their own. A slab is aligned at slab_align, so the
+ * slab of an object is found by masking its address.
+ */
+struct small_mem_pool
+{
+    smem_t heap;                    /**< heap the slabs come from */
+    size_t obj_size;                /**< aligned object size */
+    size_t objs_per_slab;           /**< number of objects of a slab */
+    size_t slab_align;              /**< alignment of a slab, the power of two covering it */
+    struct small_mem_slab *partial; /**< slabs with a free object */
+    struct small_mem_slab *full;    /**< slabs without a free object */
+    size_t slab_count;              /**< number of slabs */
+    size_t empty;                   /**< number of slabs without an object in use */
+    size_t used;                    /**< number of objects handed out */
+#if SMEM_USING_THREAD_SAFE
+    SMEM_LOCK_T lock;               /**< lock of the pool */
+#endif
+};
+typedef struct small_mem_pool *smem_pool_t;
+
+/**
+ * Occupancy of an object pool
+ */
+struct smem_pool_info
+{
+    size_t obj_size; /**< aligned object size */
+    size_t slabs;    /**< number of slabs */
+    size_t total;    /**< number of objects the slabs hold */
+    size_t used;     /**< number of objects handed out */
+};
+
+smem_pool_t smem_pool_create(smem_t heap, size_t obj_size, size_t objs_per_slab);
+void smem_pool_destroy(smem_pool_t pool);
+void *smem_pool_alloc(smem_pool_t pool);
+void smem_pool_free(smem_pool_t pool, void *obj);
+size_t smem_pool_trim(smem_pool_t pool);
+void smem_pool_info(smem_pool_t pool, struct smem_pool_info *info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SMEM_POOL_H */
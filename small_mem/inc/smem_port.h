@@ -5,6 +5,7 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdio.h>
 #include <assert.h>
 
@@ -30,6 +31,283 @@ extern "C" {
 
 #define SMEM_ALIGN_SIZE (8)
 
+/* number of segregated free lists, list n holds free blocks of [2^n, 2^(n+1)) minimum sizes */
+#ifndef SMEM_FREE_LIST_NUM
+    #define SMEM_FREE_LIST_NUM (16)
+#endif
+
+/* log2 of the second level list count of the TLSF policy, at most 5 */
+#ifndef SMEM_TLSF_SL_LOG2
+    #define SMEM_TLSF_SL_LOG2 (3)
+#endif
+
+/* number of fitting free blocks compared by the good-fit policy before it takes the best of them */
+#ifndef SMEM_GOOD_FIT_COUNT
+    #define SMEM_GOOD_FIT_COUNT (8)
+#endif
+
+/* number of handles carved from the heap at a time by smem_halloc */
+#ifndef SMEM_HANDLE_CHUNK
+    #define SMEM_HANDLE_CHUNK (16)
+#endif
+
+/* number of empty slabs an object pool keeps instead of giving them back to the heap at once */
+#ifndef SMEM_POOL_KEEP_EMPTY
+    #define SMEM_POOL_KEEP_EMPTY (1)
+#endif
+
+/*
+ * thread-safe heap mode, every heap gets its own lock and every thread keeps
+ * a small cache of recently freed blocks in front of it
+ */
+#ifndef SMEM_USING_THREAD_SAFE
+    #define SMEM_USING_THREAD_SAFE (0)
+#endif
+
+#if SMEM_USING_THREAD_SAFE
+    /* heap lock, defaults to a pthread mutex, SMEM_LOCK_STATIC initializes a lock at file scope */
+    #ifndef SMEM_LOCK_T
+        #include <pthread.h>
+        #define SMEM_PORT_PTHREAD
+        #define SMEM_LOCK_T pthread_mutex_t
+        #define SMEM_LOCK_INIT(_lock) pthread_mutex_init((_lock), NULL)
+        #define SMEM_LOCK_TAKE(_lock) pthread_mutex_lock(_lock)
+        #define SMEM_LOCK_RELEASE(_lock) pthread_mutex_unlock(_lock)
+        #define SMEM_LOCK_STATIC PTHREAD_MUTEX_INITIALIZER
+    #endif
+
+    /* largest user data size kept in the per-thread cache, 0 disables the cache */
+    #ifndef SMEM_TCACHE_MAX_SIZE
+        #define SMEM_TCACHE_MAX_SIZE (256)
+    #endif
+
+    /* number of blocks the per-thread cache keeps for every size */
+    #ifndef SMEM_TCACHE_COUNT
+        #define SMEM_TCACHE_COUNT (8)
+    #endif
+#endif
+
+/*
+ * remote frees, a thread which does not own a heap pushes the blocks it frees
+ * onto a lock-free queue of the heap instead of taking the heap lock. The next
+ * allocation under the lock releases them.
+ */
+#ifndef SMEM_USING_REMOTE_FREE
+    #define SMEM_USING_REMOTE_FREE (0)
+#endif
+
+#if SMEM_USING_REMOTE_FREE && !SMEM_USING_THREAD_SAFE
+    #error "SMEM_USING_REMOTE_FREE needs SMEM_USING_THREAD_SAFE"
+#endif
+
+/*
+ * compact block headers, an item keeps 32-bit offsets and no heap pointer so
+ * a header takes 8 bytes. The heap of a block is looked up by address among
+ * the registered heaps and regions, every thread remembers its last hit.
+ */
+#ifndef SMEM_USING_COMPACT_HEADER
+    #define SMEM_USING_COMPACT_HEADER (0)
+#endif
+
+#if SMEM_USING_COMPACT_HEADER
+    /* the registry lock is shared by every heap and cannot wait for an init call */
+    #if SMEM_USING_THREAD_SAFE && !defined(SMEM_LOCK_STATIC)
+        #error "SMEM_USING_COMPACT_HEADER with SMEM_USING_THREAD_SAFE needs SMEM_LOCK_STATIC"
+    #endif
+
+    /* maximum number of heaps and regions registered at a time */
+    #ifndef SMEM_REGISTRY_MAX
+        #define SMEM_REGISTRY_MAX (64)
+    #endif
+#endif
+
+/*
+ * runtime statistics, every heap keeps cumulative operation counters and
+ * smem_get_stats reports them with a summary of its free blocks
+ */
+#ifndef SMEM_USING_STATS
+    #define SMEM_USING_STATS (0)
+#endif
+
+/*
+ * deferred coalescing, freed blocks up to SMEM_QUICK_MAX_SIZE bytes wait on
+ * quick lists of their heap without being merged and are handed out again
+ * for the same size. They are merged in one pass when an allocation fails
+ * or SMEM_QUICK_THRESHOLD blocks are waiting.
+ */
+#ifndef SMEM_USING_QUICK_LIST
+    #define SMEM_USING_QUICK_LIST (0)
+#endif
+
+#if SMEM_USING_QUICK_LIST
+    /* largest user data size put on a quick list */
+    #ifndef SMEM_QUICK_MAX_SIZE
+        #define SMEM_QUICK_MAX_SIZE (128)
+    #endif
+
+    /* number of waiting blocks which triggers a merge pass */
+    #ifndef SMEM_QUICK_THRESHOLD
+        #define SMEM_QUICK_THRESHOLD (256)
+    #endif
+#endif
+
+/*
+ * allocation trace recorder of smem_trace.h, built on the hooks and an mmap
+ * of the trace file
+ */
+#ifndef SMEM_USING_TRACE
+    #define SMEM_USING_TRACE (0)
+#endif
+
+/*
+ * allocation hooks, a heap calls the callbacks registered by smem_set_hooks
+ * around smem_alloc, smem_realloc and smem_free
+ */
+#ifndef SMEM_USING_HOOK
+    #define SMEM_USING_HOOK (SMEM_USING_TRACE)
+#endif
+
+#if SMEM_USING_TRACE && !SMEM_USING_HOOK
+    #error "SMEM_USING_TRACE needs SMEM_USING_HOOK"
+#endif
+
+#if SMEM_USING_HOOK
+    /*
+     * time stamp of the hooks, the time stamp counter on x86 and a monotonic
+     * clock in nanoseconds elsewhere. It can be overridden here, e.g.
+     * #define SMEM_HOOK_CYCLES() rt_hw_cycle_get()
+     */
+    #ifndef SMEM_HOOK_CYCLES
+        #include <stdint.h>
+        #if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+            #define SMEM_HOOK_CYCLES() ((uint64_t)__builtin_ia32_rdtsc())
+        #else
+            #include <time.h>
+            static inline uint64_t smem_port_cycles(void)
+            {
+                struct timespec ts;
+
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+            }
+
+            #define SMEM_HOOK_CYCLES() smem_port_cycles()
+        #endif
+    #endif
+#endif
+
+/* thread local storage class, a single thread build does not need one */
+#ifndef SMEM_THREAD_LOCAL
+    #if SMEM_USING_THREAD_SAFE
+        #define SMEM_THREAD_LOCAL _Thread_local
+    #else
+        #define SMEM_THREAD_LOCAL
+    #endif
+#endif
+
+/* relaxed atomic fetch-and-add on a plain integer object */
+#ifndef SMEM_ATOMIC_FETCH_ADD
+    #if defined(__GNUC__) || defined(__clang__)
+        #define SMEM_ATOMIC_FETCH_ADD(_ptr, _val) __atomic_fetch_add((_ptr), (_val), __ATOMIC_RELAXED)
+    #else
+        #define SMEM_ATOMIC_FETCH_ADD(_ptr, _val) ((*(_ptr) += (_val)) - (_val))
+    #endif
+#endif
+
+/* acquire load of a plain integer object */
+#ifndef SMEM_ATOMIC_LOAD
+    #if defined(__GNUC__) || defined(__clang__)
+        #define SMEM_ATOMIC_LOAD(_ptr) __atomic_load_n((_ptr), __ATOMIC_ACQUIRE)
+    #else
+        #define SMEM_ATOMIC_LOAD(_ptr) (*(_ptr))
+    #endif
+#endif
+
+/* atomic pointer operations of the remote free queues */
+#if SMEM_USING_REMOTE_FREE && !defined(SMEM_ATOMIC_CAS_PTR)
+    #if defined(__GNUC__) || defined(__clang__)
+        #define SMEM_ATOMIC_LOAD_PTR(_ptr) __atomic_load_n((_ptr), __ATOMIC_ACQUIRE)
+        #define SMEM_ATOMIC_CAS_PTR(_ptr, _expected, _desired)                                                        \
+            __atomic_compare_exchange_n((_ptr), (_expected), (_desired), 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+        #define SMEM_ATOMIC_XCHG_PTR(_ptr, _val) __atomic_exchange_n((_ptr), (_val), __ATOMIC_ACQUIRE)
+    #else
+        #error "SMEM_USING_REMOTE_FREE needs SMEM_ATOMIC_LOAD_PTR, SMEM_ATOMIC_CAS_PTR and SMEM_ATOMIC_XCHG_PTR"
+    #endif
+#endif
+
+/* maximum number of heaps of a shard */
+#ifndef SMEM_SHARD_MAX
+    #define SMEM_SHARD_MAX (16)
+#endif
+
+/*
+ * id of the CPU the caller runs on, used by SMEM_SHARD_CPU. It defaults to
+ * sched_getcpu() on Linux and can be overridden here, e.g.
+ * #define SMEM_CPU_ID() rt_hw_cpu_id()
+ */
+
+/*
+ * page provider a heap grows through when it runs out of memory, see
+ * smem_set_provider. grow maps at least size bytes and stores the size it
+ * mapped in *actual, trim unmaps a range returned by grow
+ */
+typedef void *(*smem_grow_t)(size_t size, size_t *actual, void *arg);
+typedef void (*smem_trim_t)(void *addr, size_t size, void *arg);
+
+/* smallest size a heap grows by */
+#ifndef SMEM_GROW_MIN_SIZE
+    #define SMEM_GROW_MIN_SIZE (64 * 1024)
+#endif
+
+/* anonymous mmap page provider, smem_port_page_alloc and smem_port_page_free */
+#ifndef SMEM_PORT_MMAP
+    #if defined(__unix__) || defined(__APPLE__)
+        #define SMEM_PORT_MMAP (1)
+    #else
+        #define SMEM_PORT_MMAP (0)
+    #endif
+#endif
+
+#if SMEM_PORT_MMAP
+    void *smem_port_page_alloc(size_t size, size_t *actual, void *arg);
+    void smem_port_page_free(void *addr, size_t size, void *arg);
+#endif
+
+/*
+ * bit scan helpers, both return the 0-based index of a set bit and
+ * the argument must not be zero
+ * SMEM_FFS: index of the least significant set bit
+ * SMEM_FLS: index of the most significant set bit
+ */
+#if !defined(SMEM_FFS) || !defined(SMEM_FLS)
+    #if defined(__GNUC__) || defined(__clang__)
+        #define SMEM_FFS(x) (__builtin_ctzll((unsigned long long)(x)))
+        #define SMEM_FLS(x) ((int)(sizeof(unsigned long long) * 8 - 1) - __builtin_clzll((unsigned long long)(x)))
+    #else
+        static inline int smem_port_ffs(unsigned long long x)
+        {
+            int bit = 0;
+            while ((x & 0x1) == 0)
+            {
+                x >>= 1;
+                bit++;
+            }
+            return bit;
+        }
+
+        static inline int smem_port_fls(unsigned long long x)
+        {
+            int bit = 0;
+            while (x >>= 1)
+                bit++;
+            return bit;
+        }
+
+        #define SMEM_FFS(x) smem_port_ffs((unsigned long long)(x))
+        #define SMEM_FLS(x) smem_port_fls((unsigned long long)(x))
+    #endif
+#endif
+
 #ifdef __cplusplus
 }
 #endif
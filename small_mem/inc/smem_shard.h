@@ -0,0 +1,40 @@
+#ifndef __SMEM_SHARD_H
+#define __SMEM_SHARD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "smem.h"
+
+/**
+ * How a shard picks the heap of the calling thread
+ */
+enum smem_shard_mode
+{
+    SMEM_SHARD_ROUND_ROBIN = 0, /**< threads are assigned to heaps in turn on first use */
+    SMEM_SHARD_CPU,             /**< the heap follows the CPU the thread runs on */
+};
+
+/**
+ * A memory region split into several independent small memory objects
+ */
+struct small_mem_shard
+{
+    uint32_t count;                  /**< number of heaps */
+    enum smem_shard_mode mode;       /**< heap selection mode */
+    uint32_t next;                   /**< next heap handed out in round-robin mode */
+    smem_t heaps[SMEM_SHARD_MAX];    /**< the heaps */
+};
+typedef struct small_mem_shard *smem_shard_t;
+
+smem_shard_t smem_shard_init(void *begin_addr, size_t size, uint32_t count, enum smem_shard_mode mode);
+smem_t smem_shard_heap(smem_shard_t s);
+void *smem_shard_alloc(smem_shard_t s, size_t size);
+void *smem_shard_realloc(smem_shard_t s, void *rmem, size_t newsize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SMEM_SHARD_H */
@@ -0,0 +1,83 @@
+#ifndef __SMEM_TRACE_H
+#define __SMEM_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "smem.h"
+
+/**
+ * Header of a trace file, followed by count records
+ */
+struct smem_trace_header
+{
+    uint32_t magic;       /**< SMEM_TRACE_MAGIC, SMEM_TRACE_MAGIC_OPEN until smem_trace_stop finishes the file */
+    uint16_t version;     /**< SMEM_TRACE_VERSION */
+    uint16_t record_size; /**< size of a record in bytes */
+    uint32_t dropped;     /**< operations not recorded because the file was full */
+    uint32_t reserved;
+    uint64_t count;       /**< number of records */
+};
+
+/**
+ * Operation of a trace record
+ */
+enum smem_trace_op
+{
+    SMEM_TRACE_ALLOC = 0, /**< smem_alloc, smem_memalign and smem_aligned_alloc */
+    SMEM_TRACE_REALLOC,   /**< smem_realloc */
+    SMEM_TRACE_FREE,      /**< smem_free */
+    SMEM_TRACE_EXPAND,    /**< smem_try_expand which reached the size */
+    SMEM_TRACE_SHRINK,    /**< smem_try_shrink */
+};
+
+/**
+ * One operation of a trace. Handles name blocks for their whole life, 0
+ * stands for NULL: alloc has old_id 0, free has size 0 and id 0, realloc,
+ * expand and shrink have both ids. A failed realloc has id 0 and leaves
+ * old_id live.
+ */
+struct smem_trace_record
+{
+    uint32_t delta;    /**< time since the previous record in SMEM_HOOK_CYCLES units, saturated */
+    uint32_t size;     /**< requested size, saturated */
+    uint32_t id;       /**< handle of the block returned by alloc or realloc, or resized in place */
+    uint32_t old_id;   /**< handle of the block passed to realloc, expand, shrink or free */
+    uint32_t align;    /**< alignment of an alloc by smem_memalign, 0 otherwise, saturated */
+    uint32_t op;       /**< enum smem_trace_op */
+};
+
+#define SMEM_TRACE_MAGIC      (0x43525453) /* "STRC" */
+#define SMEM_TRACE_MAGIC_OPEN (0x4f525453) /* "STRO", still recording or the recorder never stopped */
+#define SMEM_TRACE_VERSION    (3)
+
+#if SMEM_USING_TRACE
+struct smem_trace_event;
+
+/**
+ * Recorder streaming the operations of a heap into a memory-mapped file
+ */
+struct small_mem_trace
+{
+    smem_t heap;                       /**< traced heap */
+    int fd;                            /**< trace file */
+    struct smem_trace_header *header;  /**< mapped file */
+    struct smem_trace_event *events;   /**< operations as reported, turned into records by smem_trace_stop */
+    size_t capacity;                   /**< number of operations the file holds */
+    uint64_t start;                    /**< time the recording started */
+#if SMEM_USING_THREAD_SAFE
+    SMEM_LOCK_T lock;                  /**< lock of the recorder */
+#endif
+};
+typedef struct small_mem_trace *smem_trace_t;
+
+int smem_trace_start(smem_trace_t trace, smem_t heap, const char *path, size_t capacity);
+size_t smem_trace_stop(smem_trace_t trace);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SMEM_TRACE_H */
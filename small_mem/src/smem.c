@@ -46,383 +46,3516 @@
  *         Simon Goldschmidt
  *
  */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #define LOG_TAG "[SMEM]"
 
+#include <stdlib.h>
 #include <string.h>
 #include "smem.h"
 #include "smem_port.h"
 
+#if SMEM_PORT_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if SMEM_USING_COMPACT_HEADER
+/* a free item only has to hold its free list links */
+#define MIN_SIZE (2 * sizeof(void *))
+
+/*
+ * bit 0 of prev marks a used item and bit 1 a used item of a handle, the
+ * owning heap is found in the registry
+ */
+#define MEM_USED_FLAG ((uint32_t)0x1)
+#define MEM_MOVABLE_FLAG ((uint32_t)0x2)
+#define MEM_FLAGS (MEM_USED_FLAG | MEM_MOVABLE_FLAG)
+
+/*
+ * The next item rewrites the offset bits of prev under the heap lock while
+ * smem_free reads the flag bits without it, the word is accessed atomically
+ */
+#if SMEM_USING_THREAD_SAFE && (defined(__GNUC__) || defined(__clang__))
+#define MEM_PREV_LOAD(_mem) __atomic_load_n(&((struct small_mem_item *)(_mem))->prev, __ATOMIC_RELAXED)
+#define MEM_PREV_STORE(_mem, _val) __atomic_store_n(&(_mem)->prev, (uint32_t)(_val), __ATOMIC_RELAXED)
+#else
+#define MEM_PREV_LOAD(_mem) (((struct small_mem_item *)(_mem))->prev)
+#define MEM_PREV_STORE(_mem, _val) ((_mem)->prev = (uint32_t)(_val))
+#endif
+
+#define MEM_ISUSED(_mem) (MEM_PREV_LOAD(_mem) & MEM_USED_FLAG)
+#define MEM_ISMOVABLE(_mem) (MEM_PREV_LOAD(_mem) & MEM_MOVABLE_FLAG)
+#define MEM_POOL(_mem) mem_registry_find(_mem)
+#define MEM_PREV(_mem) ((size_t)(MEM_PREV_LOAD(_mem) & ~MEM_FLAGS))
+#define MEM_SET_PREV(_mem, _off) MEM_PREV_STORE((_mem), (uint32_t)(_off) | (MEM_PREV_LOAD(_mem) & MEM_FLAGS))
+#define MEM_SET_USED(_heap, _mem) MEM_PREV_STORE((_mem), (MEM_PREV_LOAD(_mem) & ~MEM_MOVABLE_FLAG) | MEM_USED_FLAG)
+#define MEM_SET_MOVABLE(_mem) MEM_PREV_STORE((_mem), MEM_PREV_LOAD(_mem) | MEM_MOVABLE_FLAG)
+#define MEM_SET_FREED(_heap, _mem) MEM_PREV_STORE((_mem), MEM_PREV_LOAD(_mem) & ~MEM_FLAGS)
+#define MEM_CLEAR(_mem) MEM_PREV_STORE((_mem), 0)
+#else
 #define MIN_SIZE (sizeof(uintptr_t) + sizeof(size_t) + sizeof(size_t))
 
-#define MEM_MASK ((~(size_t)0) - 1)
+/* bit 0 of the heap pointer marks a used item and bit 1 a used item of a handle */
+#define MEM_MASK ((~(size_t)0) - 3)
 
 #define MEM_USED(_mem) ((((uintptr_t)(_mem)) & MEM_MASK) | 0x1)
 #define MEM_FREED(_mem) ((((uintptr_t)(_mem)) & MEM_MASK) | 0x0)
-#define MEM_ISUSED(_mem) (((uintptr_t)(((struct small_mem_item *)(_mem))->pool_ptr)) & (~MEM_MASK))
+#define MEM_ISUSED(_mem) (((uintptr_t)(((struct small_mem_item *)(_mem))->pool_ptr)) & 0x1)
+#define MEM_ISMOVABLE(_mem) (((uintptr_t)(((struct small_mem_item *)(_mem))->pool_ptr)) & 0x2)
 #define MEM_POOL(_mem) ((struct small_mem *)(((uintptr_t)(((struct small_mem_item *)(_mem))->pool_ptr)) & (MEM_MASK)))
-#define MEM_SIZE(_heap, _mem)                                                                                          \
-    (((struct small_mem_item *)(_mem))->next - ((uintptr_t)(_mem) - (uintptr_t)((_heap)->heap_ptr)) -                  \
-     SMEM_ALIGN(sizeof(struct small_mem_item), SMEM_ALIGN_SIZE))
+#define MEM_PREV(_mem) (((struct small_mem_item *)(_mem))->prev)
+#define MEM_SET_PREV(_mem, _off) ((_mem)->prev = (_off))
+#define MEM_SET_USED(_heap, _mem) ((_mem)->pool_ptr = MEM_USED(_heap))
+#define MEM_SET_MOVABLE(_mem) ((_mem)->pool_ptr |= 0x2)
+#define MEM_SET_FREED(_heap, _mem) ((_mem)->pool_ptr = MEM_FREED(_heap))
+#define MEM_CLEAR(_mem) ((_mem)->pool_ptr = 0)
+#endif
 
 #define MIN_SIZE_ALIGNED SMEM_ALIGN(MIN_SIZE, SMEM_ALIGN_SIZE)
 #define SIZEOF_STRUCT_MEM SMEM_ALIGN(sizeof(struct small_mem_item), SMEM_ALIGN_SIZE)
 
-static void plug_holes(struct small_mem *m, struct small_mem_item *mem)
+/*
+ * Items link each other by offsets from heap_ptr. Added regions may lie
+ * below heap_ptr, their offsets wrap around and are computed on integers.
+ * Compact headers keep 32-bit offsets, which reach 2 GB on either side.
+ */
+#if SMEM_USING_COMPACT_HEADER
+#define MEM_ITEM(_heap, _off)                                                                                          \
+    ((struct small_mem_item *)((uintptr_t)(_heap)->heap_ptr + (uintptr_t)(intptr_t)(int32_t)(uint32_t)(_off)))
+#define MEM_OFFSET(_heap, _mem) ((size_t)(uint32_t)((uintptr_t)(_mem) - (uintptr_t)(_heap)->heap_ptr))
+#else
+#define MEM_ITEM(_heap, _off) ((struct small_mem_item *)((uintptr_t)(_heap)->heap_ptr + (size_t)(_off)))
+#define MEM_OFFSET(_heap, _mem) ((size_t)((uintptr_t)(_mem) - (uintptr_t)(_heap)->heap_ptr))
+#endif
+
+#define MEM_SIZE(_heap, _mem)                                                                                          \
+    (((struct small_mem_item *)(_mem))->next - MEM_OFFSET((_heap), (_mem)) - SIZEOF_STRUCT_MEM)
+
+/* largest request worth a search, a heap with a grow callback can take any */
+#define MEM_SIZE_MAX(_heap) ((_heap)->grow != NULL ? (~(size_t)0 >> 2) : (_heap)->region_max)
+
+/* first item of a region added after init */
+#define MEM_REGION_FIRST(_region)                                                                                      \
+    ((struct small_mem_item *)SMEM_ALIGN((uintptr_t)(_region) + sizeof(struct small_mem_region), SMEM_ALIGN_SIZE))
+
+#if SMEM_USING_THREAD_SAFE
+#define MEM_LOCK(_heap) SMEM_LOCK_TAKE(&(_heap)->lock)
+#define MEM_UNLOCK(_heap) SMEM_LOCK_RELEASE(&(_heap)->lock)
+
+/* every initialized heap gets a new serial */
+static uint32_t mem_serial;
+
+#if SMEM_USING_REMOTE_FREE
+/* its address tells the threads apart, a heap keeps the one of its owner */
+static SMEM_THREAD_LOCAL char remote_self;
+
+/*
+ * A heap without owner is freed into directly by every thread. Threads
+ * bound to the same heap may claim it at any time, the owner is read and
+ * written atomically.
+ */
+#define MEM_REMOTE(_heap) mem_remote(_heap)
+
+static int mem_remote(struct small_mem *m)
 {
-    struct small_mem_item *nmem;
-    struct small_mem_item *pmem;
+    const void *owner = SMEM_ATOMIC_LOAD_PTR(&m->owner);
 
-    _ASSERT((uint8_t *)mem >= m->heap_ptr);
-    _ASSERT((uint8_t *)mem < (uint8_t *)m->heap_end);
+    return owner != NULL && owner != &remote_self;
+}
+#endif
+#else
+#define MEM_LOCK(_heap)
+#define MEM_UNLOCK(_heap)
+#endif
 
-    /* plug hole forward */
-    nmem = (struct small_mem_item *)&m->heap_ptr[mem->next];
-    if (mem != nmem && !MEM_ISUSED(nmem) && (uint8_t *)nmem != (uint8_t *)m->heap_end)
-    {
-        /* if mem->next is unused and not end of m->heap_ptr,
-         * combine mem and mem->next
-         */
-        if (m->lfree == nmem)
-        {
-            m->lfree = mem;
-        }
-        nmem->pool_ptr = 0;
-        mem->next = nmem->next;
-        ((struct small_mem_item *)&m->heap_ptr[nmem->next])->prev = (uint8_t *)mem - m->heap_ptr;
-    }
+/*
+ * Statistics counters. The operation counters are bumped outside the heap
+ * lock by the per-thread cache paths, the search counters only under it.
+ */
+#if SMEM_USING_STATS
+#if SMEM_USING_THREAD_SAFE
+#define MEM_STAT_ADD(_heap, _field, _val) ((void)SMEM_ATOMIC_FETCH_ADD(&(_heap)->stats._field, (size_t)(_val)))
+#else
+#define MEM_STAT_ADD(_heap, _field, _val) ((void)((_heap)->stats._field += (size_t)(_val)))
+#endif
+#define MEM_STAT_LOCKED(_heap, _field) ((void)(_heap)->stats._field++)
+#else
+#define MEM_STAT_ADD(_heap, _field, _val) ((void)0)
+#define MEM_STAT_LOCKED(_heap, _field) ((void)0)
+#endif
+#define MEM_STAT_INC(_heap, _field) MEM_STAT_ADD(_heap, _field, 1)
 
-    /* plug hole backward */
-    pmem = (struct small_mem_item *)&m->heap_ptr[mem->prev];
-    if (pmem != mem && !MEM_ISUSED(pmem))
+/*
+ * Sequence of the operations reported to the post hook. An operation takes its
+ * number where its block changes hands, under the heap lock or before a
+ * lock-free release makes the block reachable by another thread. A released
+ * block thus has a smaller number than the operation taking it again,
+ * whichever of the two hooks runs first.
+ */
+#if SMEM_USING_HOOK
+#define MEM_SEQ_NONE (~(uint64_t)0)
+static SMEM_THREAD_LOCAL uint64_t mem_seq;
+#if SMEM_USING_THREAD_SAFE
+#define MEM_SEQ_NEXT(_heap) SMEM_ATOMIC_FETCH_ADD(&(_heap)->hook_seq, (uint64_t)1)
+#else
+#define MEM_SEQ_NEXT(_heap) ((_heap)->hook_seq++)
+#endif
+#define MEM_SEQ(_heap) ((_heap)->hook_post != NULL ? (void)(mem_seq = MEM_SEQ_NEXT(_heap)) : (void)0)
+#else
+#define MEM_SEQ(_heap) ((void)0)
+#endif
+
+/*
+ * Free items keep their segregated list links in the user data space,
+ * MIN_SIZE guarantees there is always room for them.
+ */
+struct small_mem_link
+{
+    struct small_mem_item *next; /**< next free item of the same size class */
+    struct small_mem_item *prev; /**< prev free item of the same size class */
+};
+
+#define MEM_LINK(_mem) ((struct small_mem_link *)((uint8_t *)(_mem) + SIZEOF_STRUCT_MEM))
+
+#if SMEM_USING_COMPACT_HEADER
+/*
+ * Compact headers do not point to their heap. Every heap and region is
+ * registered by address range, the ranges are sorted by address and a
+ * block finds its heap by a binary search. Every change of the registry
+ * bumps its generation, a thread keeps the range of its last lookup and
+ * reuses it while the generation stays, which spares the registry lock
+ * when a thread frees into the same heap again and again.
+ */
+struct small_mem_range
+{
+    uintptr_t begin;        /**< first byte of the range */
+    uintptr_t end;          /**< first byte behind the range */
+    struct small_mem *heap; /**< heap owning the range */
+};
+
+static struct small_mem_range mem_registry[SMEM_REGISTRY_MAX];
+static size_t mem_registry_count;
+static uint32_t mem_registry_gen;
+
+/* range of the last lookup of this thread and the generation it was found in */
+static SMEM_THREAD_LOCAL struct small_mem_range mem_registry_hit;
+static SMEM_THREAD_LOCAL uint32_t mem_registry_hit_gen;
+
+#if SMEM_USING_THREAD_SAFE
+static SMEM_LOCK_T mem_registry_lock = SMEM_LOCK_STATIC;
+
+/* the registry lock nests inside a heap lock, never the other way round */
+#define REGISTRY_LOCK() SMEM_LOCK_TAKE(&mem_registry_lock)
+#define REGISTRY_UNLOCK() SMEM_LOCK_RELEASE(&mem_registry_lock)
+#else
+#define REGISTRY_LOCK()
+#define REGISTRY_UNLOCK()
+#endif
+
+static struct small_mem *mem_registry_find(const void *ptr)
+{
+    struct small_mem *heap = NULL;
+    size_t low = 0, high, mid;
+    uint32_t gen;
+
+    gen = SMEM_ATOMIC_LOAD(&mem_registry_gen);
+    if (mem_registry_hit_gen == gen && (uintptr_t)ptr >= mem_registry_hit.begin &&
+        (uintptr_t)ptr < mem_registry_hit.end)
+        return mem_registry_hit.heap;
+
+    REGISTRY_LOCK();
+    high = mem_registry_count;
+    while (low < high)
     {
-        /* if mem->prev is unused, combine mem and mem->prev */
-        if (m->lfree == mem)
+        mid = low + (high - low) / 2;
+        if ((uintptr_t)ptr < mem_registry[mid].begin)
+            high = mid;
+        else if ((uintptr_t)ptr >= mem_registry[mid].end)
+            low = mid + 1;
+        else
         {
-            m->lfree = pmem;
+            heap = mem_registry[mid].heap;
+            mem_registry_hit = mem_registry[mid];
+            mem_registry_hit_gen = mem_registry_gen;
+            break;
         }
-        mem->pool_ptr = 0;
-        pmem->next = mem->next;
-        ((struct small_mem_item *)&m->heap_ptr[mem->next])->prev = (uint8_t *)pmem - m->heap_ptr;
     }
+    REGISTRY_UNLOCK();
+
+    return heap;
 }
 
-/**
- * @brief This function will initialize small memory management algorithm.
- *
- * @param begin_addr the beginning address of memory.
- *
- * @param size is the size of the memory.
- *
- * @return Return a pointer to the memory object. When the return value is NULL, it means the init failed.
- */
-smem_t smem_init(void *begin_addr, size_t size)
+/* the registry lock is held */
+static void mem_registry_remove(size_t index)
 {
-    struct small_mem_item *mem;
-    struct small_mem *small_mem;
-    uintptr_t staaddr, begin_align, end_align, mem_size;
+    memmove(&mem_registry[index], &mem_registry[index + 1],
+            (mem_registry_count - index - 1) * sizeof(mem_registry[0]));
+    mem_registry_count--;
+    SMEM_ATOMIC_FETCH_ADD(&mem_registry_gen, 1);
+}
 
-    small_mem = (struct small_mem *)SMEM_ALIGN((uintptr_t)begin_addr, SMEM_ALIGN_SIZE);
-    staaddr = (uintptr_t)small_mem + sizeof(*small_mem);
-    begin_align = SMEM_ALIGN((uintptr_t)staaddr, SMEM_ALIGN_SIZE);
-    end_align = SMEM_ALIGN_DOWN((uintptr_t)begin_addr + size, SMEM_ALIGN_SIZE);
+static int mem_registry_add(struct small_mem *heap, const void *begin, const void *end)
+{
+    size_t index;
 
-    /* alignment addr */
-    if ((end_align > (2 * SIZEOF_STRUCT_MEM)) && ((end_align - 2 * SIZEOF_STRUCT_MEM) >= staaddr))
+    REGISTRY_LOCK();
+    /* memory initialized again no longer belongs to its old heap */
+    index = 0;
+    while (index < mem_registry_count)
     {
-        /* calculate the aligned memory size */
-        mem_size = end_align - begin_align - 2 * SIZEOF_STRUCT_MEM;
+        if (mem_registry[index].begin < (uintptr_t)end && mem_registry[index].end > (uintptr_t)begin)
+            mem_registry_remove(index);
+        else
+            index++;
     }
-    else
-    {
-        LOG_E("mem init, error begin address 0x%lx, and end address 0x%lx\r\n", (uintptr_t)begin_addr,
-                (uintptr_t)begin_addr + size);
 
-        return NULL;
+    if (mem_registry_count == SMEM_REGISTRY_MAX)
+    {
+        REGISTRY_UNLOCK();
+        LOG_E("mem registry full, raise SMEM_REGISTRY_MAX\r\n");
+        return -1;
     }
 
-    memset(small_mem, 0, sizeof(*small_mem));
-    /* initialize small memory object */
-    small_mem->parent.address = begin_align;
-    small_mem->parent.total = mem_size;
-    small_mem->mem_size_aligned = mem_size;
+    index = 0;
+    while (index < mem_registry_count && mem_registry[index].begin < (uintptr_t)begin)
+        index++;
+    memmove(&mem_registry[index + 1], &mem_registry[index], (mem_registry_count - index) * sizeof(mem_registry[0]));
+    mem_registry[index].begin = (uintptr_t)begin;
+    mem_registry[index].end = (uintptr_t)end;
+    mem_registry[index].heap = heap;
+    mem_registry_count++;
+    SMEM_ATOMIC_FETCH_ADD(&mem_registry_gen, 1);
+    REGISTRY_UNLOCK();
+
+    return 0;
+}
 
-    /* point to begin address of heap */
-    small_mem->heap_ptr = (uint8_t *)begin_align;
+/*
+ * Drop the range starting at begin, or every range of heap when begin is NULL.
+ */
+static void mem_registry_drop(struct small_mem *heap, const void *begin)
+{
+    size_t index = 0;
 
-    LOG_D("mem init, heap begin address 0x%lx, size %ld\r\n", (uintptr_t)small_mem->heap_ptr, small_mem->mem_size_aligned);
+    REGISTRY_LOCK();
+    while (index < mem_registry_count)
+    {
+        if (mem_registry[index].heap == heap && (begin == NULL || mem_registry[index].begin == (uintptr_t)begin))
+            mem_registry_remove(index);
+        else
+            index++;
+    }
+    REGISTRY_UNLOCK();
+}
+#endif
 
-    /* initialize the start of the heap */
-    mem = (struct small_mem_item *)small_mem->heap_ptr;
-    mem->pool_ptr = MEM_FREED(small_mem);
-    mem->next = small_mem->mem_size_aligned + SIZEOF_STRUCT_MEM;
-    mem->prev = 0;
+static int free_list_index(size_t size)
+{
+    int index;
 
-    /* initialize the end of the heap */
-    small_mem->heap_end = (struct small_mem_item *)&small_mem->heap_ptr[mem->next];
-    small_mem->heap_end->pool_ptr = MEM_USED(small_mem);
-    small_mem->heap_end->next = small_mem->mem_size_aligned + SIZEOF_STRUCT_MEM;
-    small_mem->heap_end->prev = small_mem->mem_size_aligned + SIZEOF_STRUCT_MEM;
+    index = SMEM_FLS(size) - SMEM_FLS(MIN_SIZE_ALIGNED);
+    if (index >= SMEM_FREE_LIST_NUM)
+        index = SMEM_FREE_LIST_NUM - 1;
 
-    /* initialize the lowest-free pointer to the start of the heap */
-    small_mem->lfree = (struct small_mem_item *)small_mem->heap_ptr;
+    return index;
+}
 
-    return (smem_t)(&small_mem->parent);
+static void free_list_insert(struct small_mem *m, struct small_mem_item *mem)
+{
+    struct small_mem_link *link;
+    int index;
+
+    index = free_list_index(MEM_SIZE(m, mem));
+    link = MEM_LINK(mem);
+    link->prev = NULL;
+    link->next = m->free_list[index];
+    if (link->next != NULL)
+        MEM_LINK(link->next)->prev = mem;
+
+    m->free_list[index] = mem;
+    m->free_bitmap |= (uint32_t)1 << index;
 }
 
-/**
- * @addtogroup group_memory_management
- */
+static void free_list_remove(struct small_mem *m, struct small_mem_item *mem)
+{
+    struct small_mem_link *link;
+    int index;
 
-/**@{*/
+    link = MEM_LINK(mem);
+    if (link->next != NULL)
+        MEM_LINK(link->next)->prev = link->prev;
 
-/**
- * @brief Allocate a block of memory with a minimum of 'size' bytes.
- *
- * @param m the small memory management object.
- *
- * @param size is the minimum size of the requested block in bytes.
- *
- * @return the pointer to allocated memory or NULL if no free memory was found.
- */
-void *smem_alloc(smem_t m, size_t size)
+    if (link->prev != NULL)
+    {
+        MEM_LINK(link->prev)->next = link->next;
+    }
+    else
+    {
+        /* mem is the head of its list, the size must not change before removing it */
+        index = free_list_index(MEM_SIZE(m, mem));
+        _ASSERT(m->free_list[index] == mem);
+        m->free_list[index] = link->next;
+        if (link->next == NULL)
+            m->free_bitmap &= ~((uint32_t)1 << index);
+    }
+}
+
+static struct small_mem_item *free_list_find(struct small_mem *m, size_t size)
 {
-    size_t ptr, ptr2;
-    struct small_mem_item *mem, *mem2;
-    struct small_mem *small_mem;
+    struct small_mem_item *mem;
+    uint32_t bitmap;
+    int index;
 
-    if (size == 0)
+    index = free_list_index(size);
+
+    /* items of the same size class may still be too small, search it first-fit */
+    for (mem = m->free_list[index]; mem != NULL; mem = MEM_LINK(mem)->next)
+    {
+        MEM_STAT_LOCKED(m, search_steps);
+        if (MEM_SIZE(m, mem) >= size)
+            return mem;
+    }
+
+    /* every item of a larger size class fits, take the head of the smallest one */
+    bitmap = m->free_bitmap & ~(((uint32_t)2 << index) - 1);
+    if (bitmap == 0)
         return NULL;
 
-    _ASSERT(m != NULL);
+    MEM_STAT_LOCKED(m, search_steps);
+    return m->free_list[SMEM_FFS(bitmap)];
+}
 
-    small_mem = (struct small_mem *)m;
-    /* alignment size */
-    size = SMEM_ALIGN(size, SMEM_ALIGN_SIZE);
+/*
+ * Two-level segregated fit index. The first level splits sizes by power of
+ * two, the second level splits every power of two range linearly into
+ * TLSF_SL_COUNT lists. Sizes below TLSF_SMALL_SIZE are all kept in first
+ * level 0 with a linear SMEM_ALIGN_SIZE granularity.
+ */
+#define TLSF_SL_COUNT (1 << SMEM_TLSF_SL_LOG2)
+#define TLSF_FL_SHIFT (SMEM_TLSF_SL_LOG2 + SMEM_FLS(SMEM_ALIGN_SIZE))
+#define TLSF_SMALL_SIZE ((size_t)1 << TLSF_FL_SHIFT)
+#define TLSF_FL_MAX (32)
 
-    /* every data block must be at least MIN_SIZE_ALIGNED long */
-    if (size < MIN_SIZE_ALIGNED)
-        size = MIN_SIZE_ALIGNED;
+struct small_mem_tlsf
+{
+    uint32_t fl_bitmap;             /**< bit n is set when sl_bitmap[n] is not zero */
+    uint32_t fl_count;              /**< number of first level indexes */
+    uint32_t *sl_bitmap;            /**< bit n of sl_bitmap[fl] is set when blocks[fl][n] is not empty */
+    struct small_mem_item **blocks; /**< fl_count * TLSF_SL_COUNT list heads */
+};
+
+static void tlsf_mapping(const struct small_mem_tlsf *tlsf, size_t size, uint32_t *fl, uint32_t *sl)
+{
+    int bit;
 
-    if (size > small_mem->mem_size_aligned)
+    if (size < TLSF_SMALL_SIZE)
     {
-        LOG_D("no memory\r\n");
-        return NULL;
+        *fl = 0;
+        *sl = (uint32_t)(size / SMEM_ALIGN_SIZE);
+        return;
     }
 
-    for (ptr = (uint8_t *)small_mem->lfree - small_mem->heap_ptr; ptr <= small_mem->mem_size_aligned - size;
-         ptr = ((struct small_mem_item *)&small_mem->heap_ptr[ptr])->next)
+    bit = SMEM_FLS(size);
+    *fl = (uint32_t)(bit - TLSF_FL_SHIFT + 1);
+    *sl = (uint32_t)(size >> (bit - SMEM_TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+    if (*fl >= tlsf->fl_count)
     {
-        mem = (struct small_mem_item *)&small_mem->heap_ptr[ptr];
+        /* larger than any index, everything beyond is kept in the last list */
+        *fl = tlsf->fl_count - 1;
+        *sl = TLSF_SL_COUNT - 1;
+    }
+}
 
-        if ((!MEM_ISUSED(mem)) && (mem->next - (ptr + SIZEOF_STRUCT_MEM)) >= size)
-        {
-            /* mem is not used and at least perfect fit is possible:
-             * mem->next - (ptr + SIZEOF_STRUCT_MEM) gives us the 'user data size' of mem */
+static size_t tlsf_control_size(size_t size)
+{
+    uint32_t fl_count;
 
-            if (mem->next - (ptr + SIZEOF_STRUCT_MEM) >= (size + SIZEOF_STRUCT_MEM + MIN_SIZE_ALIGNED))
-            {
-                /* (in addition to the above, we test if another struct small_mem_item (SIZEOF_STRUCT_MEM) containing
-                 * at least MIN_SIZE_ALIGNED of data also fits in the 'user data space' of 'mem')
-                 * -> split large block, create empty remainder,
-                 * remainder must be large enough to contain MIN_SIZE_ALIGNED data: if
-                 * mem->next - (ptr + (2*SIZEOF_STRUCT_MEM)) == size,
-                 * struct small_mem_item would fit in but no data between mem2 and mem2->next
-                 * @todo we could leave out MIN_SIZE_ALIGNED. We would create an empty
-                 *       region that couldn't hold data, but when mem->next gets freed,
-                 *       the 2 regions would be combined, resulting in more free memory
-                 */
-                ptr2 = ptr + SIZEOF_STRUCT_MEM + size;
-
-                /* create mem2 struct */
-                mem2 = (struct small_mem_item *)&small_mem->heap_ptr[ptr2];
-                mem2->pool_ptr = MEM_FREED(small_mem);
-                mem2->next = mem->next;
-                mem2->prev = ptr;
-
-                /* and insert it between mem and mem->next */
-                mem->next = ptr2;
-
-                if (mem2->next != small_mem->mem_size_aligned + SIZEOF_STRUCT_MEM)
-                {
-                    ((struct small_mem_item *)&small_mem->heap_ptr[mem2->next])->prev = ptr2;
-                }
-                small_mem->parent.used += (size + SIZEOF_STRUCT_MEM);
-                if (small_mem->parent.max < small_mem->parent.used)
-                    small_mem->parent.max = small_mem->parent.used;
-            }
-            else
-            {
-                /* (a mem2 struct does no fit into the user data space of mem and mem->next will always
-                 * be used at this point: if not we have 2 unused structs in a row, plug_holes should have
-                 * take care of this).
-                 * -> near fit or excact fit: do not split, no mem2 creation
-                 * also can't move mem->next directly behind mem, since mem->next
-                 * will always be used at this point!
-                 */
-                small_mem->parent.used += mem->next - ((uint8_t *)mem - small_mem->heap_ptr);
-                if (small_mem->parent.max < small_mem->parent.used)
-                    small_mem->parent.max = small_mem->parent.used;
-            }
-            /* set small memory object */
-            mem->pool_ptr = MEM_USED(small_mem);
+    fl_count = size < TLSF_SMALL_SIZE ? 1 : (uint32_t)(SMEM_FLS(size) - TLSF_FL_SHIFT + 2);
+    if (fl_count > TLSF_FL_MAX)
+        fl_count = TLSF_FL_MAX;
 
-            if (mem == small_mem->lfree)
-            {
-                /* Find next free block after mem and update lowest free pointer */
-                while (MEM_ISUSED(small_mem->lfree) && small_mem->lfree != small_mem->heap_end)
-                    small_mem->lfree = (struct small_mem_item *)&small_mem->heap_ptr[small_mem->lfree->next];
+    return SMEM_ALIGN(sizeof(struct small_mem_tlsf), SMEM_ALIGN_SIZE) +
+           SMEM_ALIGN(fl_count * sizeof(uint32_t), SMEM_ALIGN_SIZE) +
+           fl_count * TLSF_SL_COUNT * sizeof(struct small_mem_item *);
+}
 
-                _ASSERT(((small_mem->lfree == small_mem->heap_end) || (!MEM_ISUSED(small_mem->lfree))));
-            }
-            _ASSERT((uintptr_t)mem + SIZEOF_STRUCT_MEM + size <= (uintptr_t)small_mem->heap_end);
-            _ASSERT((uintptr_t)((uint8_t *)mem + SIZEOF_STRUCT_MEM) % SMEM_ALIGN_SIZE == 0);
-            _ASSERT((((uintptr_t)mem) & (SMEM_ALIGN_SIZE - 1)) == 0);
+static struct small_mem_tlsf *tlsf_create(void *addr, size_t size)
+{
+    struct small_mem_tlsf *tlsf;
+    uint8_t *ptr;
 
-            LOG_I("allocate memory at 0x%lx, size: %ld\r\n", (uintptr_t)((uint8_t *)mem + SIZEOF_STRUCT_MEM),
-                  (uintptr_t)(mem->next - ((uint8_t *)mem - small_mem->heap_ptr)));
+    tlsf = (struct small_mem_tlsf *)addr;
+    tlsf->fl_bitmap = 0;
+    tlsf->fl_count = size < TLSF_SMALL_SIZE ? 1 : (uint32_t)(SMEM_FLS(size) - TLSF_FL_SHIFT + 2);
+    if (tlsf->fl_count > TLSF_FL_MAX)
+        tlsf->fl_count = TLSF_FL_MAX;
 
-            /* return the memory data except mem struct */
-            return (uint8_t *)mem + SIZEOF_STRUCT_MEM;
-        }
-    }
+    ptr = (uint8_t *)addr + SMEM_ALIGN(sizeof(struct small_mem_tlsf), SMEM_ALIGN_SIZE);
+    tlsf->sl_bitmap = (uint32_t *)ptr;
+    memset(tlsf->sl_bitmap, 0, tlsf->fl_count * sizeof(uint32_t));
 
-    return NULL;
+    ptr += SMEM_ALIGN(tlsf->fl_count * sizeof(uint32_t), SMEM_ALIGN_SIZE);
+    tlsf->blocks = (struct small_mem_item **)ptr;
+    memset(tlsf->blocks, 0, tlsf->fl_count * TLSF_SL_COUNT * sizeof(struct small_mem_item *));
+
+    return tlsf;
 }
 
-/**
- * @brief This function will change the size of previously allocated memory block.
- *
- * @param m the small memory management object.
- *
- * @param rmem is the pointer to memory allocated by mem_alloc.
- *
- * @param newsize is the required new size.
- *
- * @return the changed memory block address.
- */
-void *smem_realloc(smem_t m, void *rmem, size_t newsize)
+static void tlsf_insert(struct small_mem *m, struct small_mem_item *mem)
 {
-    size_t size;
-    size_t ptr, ptr2;
-    struct small_mem_item *mem, *mem2;
-    struct small_mem *small_mem;
-    void *nmem;
+    struct small_mem_tlsf *tlsf = m->tlsf;
+    struct small_mem_link *link;
+    uint32_t fl, sl;
+
+    tlsf_mapping(tlsf, MEM_SIZE(m, mem), &fl, &sl);
+    link = MEM_LINK(mem);
+    link->prev = NULL;
+    link->next = tlsf->blocks[fl * TLSF_SL_COUNT + sl];
+    if (link->next != NULL)
+        MEM_LINK(link->next)->prev = mem;
+
+    tlsf->blocks[fl * TLSF_SL_COUNT + sl] = mem;
+    tlsf->fl_bitmap |= (uint32_t)1 << fl;
+    tlsf->sl_bitmap[fl] |= (uint32_t)1 << sl;
+}
 
-    _ASSERT(m != NULL);
+static void tlsf_remove(struct small_mem *m, struct small_mem_item *mem)
+{
+    struct small_mem_tlsf *tlsf = m->tlsf;
+    struct small_mem_link *link;
+    uint32_t fl, sl;
 
-    small_mem = (struct small_mem *)m;
-    /* alignment size */
-    newsize = SMEM_ALIGN(newsize, SMEM_ALIGN_SIZE);
-    if (newsize > small_mem->mem_size_aligned)
+    link = MEM_LINK(mem);
+    if (link->next != NULL)
+        MEM_LINK(link->next)->prev = link->prev;
+
+    if (link->prev != NULL)
     {
-        LOG_D("realloc: out of memory\r\n");
-        return NULL;
+        MEM_LINK(link->prev)->next = link->next;
     }
-    else if (newsize == 0)
+    else
     {
-        smem_free(rmem);
-        return NULL;
+        tlsf_mapping(tlsf, MEM_SIZE(m, mem), &fl, &sl);
+        _ASSERT(tlsf->blocks[fl * TLSF_SL_COUNT + sl] == mem);
+        tlsf->blocks[fl * TLSF_SL_COUNT + sl] = link->next;
+        if (link->next == NULL)
+        {
+            tlsf->sl_bitmap[fl] &= ~((uint32_t)1 << sl);
+            if (tlsf->sl_bitmap[fl] == 0)
+                tlsf->fl_bitmap &= ~((uint32_t)1 << fl);
+        }
     }
+}
 
-    /* allocate a new memory block */
-    if (rmem == NULL)
-        return smem_alloc((smem_t)(&small_mem->parent), newsize);
-
-    _ASSERT((((uintptr_t)rmem) & (SMEM_ALIGN_SIZE - 1)) == 0);
-    _ASSERT((uint8_t *)rmem >= (uint8_t *)small_mem->heap_ptr);
-    _ASSERT((uint8_t *)rmem < (uint8_t *)small_mem->heap_end);
-
-    mem = (struct small_mem_item *)((uint8_t *)rmem - SIZEOF_STRUCT_MEM);
+static struct small_mem_item *tlsf_find(struct small_mem *m, size_t size)
+{
+    struct small_mem_tlsf *tlsf = m->tlsf;
+    struct small_mem_item *mem;
+    uint32_t fl, sl, bitmap;
+    size_t round;
 
-    /* current memory block size */
-    ptr = (uint8_t *)mem - small_mem->heap_ptr;
-    size = mem->next - ptr - SIZEOF_STRUCT_MEM;
-    if (size == newsize)
-    {
-        /* the size is the same as */
-        return rmem;
-    }
+    /* round the request up to the next list so that every item of the list fits */
+    round = size;
+    if (round >= TLSF_SMALL_SIZE)
+        round += ((size_t)1 << (SMEM_FLS(round) - SMEM_TLSF_SL_LOG2)) - 1;
+    tlsf_mapping(tlsf, round, &fl, &sl);
 
-    if (newsize + SIZEOF_STRUCT_MEM + MIN_SIZE < size)
+    bitmap = tlsf->sl_bitmap[fl] & (~(uint32_t)0 << sl);
+    if (bitmap == 0)
     {
-        /* split memory block */
-        small_mem->parent.used -= (size - newsize);
-
-        ptr2 = ptr + SIZEOF_STRUCT_MEM + newsize;
-        mem2 = (struct small_mem_item *)&small_mem->heap_ptr[ptr2];
-        mem2->pool_ptr = MEM_FREED(small_mem);
-        mem2->next = mem->next;
-        mem2->prev = ptr;
-        mem->next = ptr2;
-        if (mem2->next != small_mem->mem_size_aligned + SIZEOF_STRUCT_MEM)
-        {
-            ((struct small_mem_item *)&small_mem->heap_ptr[mem2->next])->prev = ptr2;
-        }
-
-        if (mem2 < small_mem->lfree)
+        bitmap = fl + 1 < TLSF_FL_MAX ? tlsf->fl_bitmap & (~(uint32_t)0 << (fl + 1)) : 0;
+        if (bitmap != 0)
         {
-            /* the splited struct is now the lowest */
-            small_mem->lfree = mem2;
+            fl = SMEM_FFS(bitmap);
+            bitmap = tlsf->sl_bitmap[fl];
         }
+    }
 
-        plug_holes(small_mem, mem2);
-
-        return rmem;
+    if (bitmap != 0)
+    {
+        mem = tlsf->blocks[fl * TLSF_SL_COUNT + SMEM_FFS(bitmap)];
+        MEM_STAT_LOCKED(m, search_steps);
+        if (MEM_SIZE(m, mem) >= size)
+            return mem;
     }
 
-    /* expand memory */
-    nmem = smem_alloc((smem_t)(&small_mem->parent), newsize);
-    if (nmem != NULL) /* check memory */
+    /*
+     * no list guarantees a fit, the list of the unrounded size may still hold
+     * a large enough item, which matters when the heap is nearly exhausted
+     */
+    tlsf_mapping(tlsf, size, &fl, &sl);
+    for (mem = tlsf->blocks[fl * TLSF_SL_COUNT + sl]; mem != NULL; mem = MEM_LINK(mem)->next)
     {
-        memcpy(nmem, rmem, size < newsize ? size : newsize);
-        smem_free(rmem);
+        MEM_STAT_LOCKED(m, search_steps);
+        if (MEM_SIZE(m, mem) >= size)
+            return mem;
     }
 
-    return nmem;
+    return NULL;
 }
 
-/**
- * @brief This function will release the previously allocated memory block by
- *        mem_alloc. The released memory block is taken back to system heap.
- *
- * @param rmem the address of memory which will be released.
+/*
+ * Granule bitmap, one bit per SMEM_ALIGN_SIZE granule of the heap given to
+ * smem_init_ex, set for the granules of free items. A summary level keeps
+ * one bit per bitmap word which has any bit set, so a search skips 4096
+ * used granules per summary word and reads the header of free items only.
+ * Items of added regions are not covered and are kept in the
+ * address-ordered list instead.
  */
-void smem_free(void *rmem)
-{
-    struct small_mem_item *mem;
-    struct small_mem *small_mem;
+#define BITMAP_GRANULE SMEM_ALIGN_SIZE
+#define BITMAP_WORD_BITS (64)
+#define BITMAP_WORDS(_bits) (((_bits) + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS)
 
-    if (rmem == NULL)
-        return;
+#define MEM_BITMAPPED(_heap, _mem)                                          \
+    ((_heap)->policy == SMEM_POLICY_BITMAP && (uint8_t *)(_mem) >= (_heap)->heap_ptr && \
+     (struct small_mem_item *)(_mem) < (_heap)->heap_end)
 
-    _ASSERT((((uintptr_t)rmem) & (SMEM_ALIGN_SIZE - 1)) == 0);
+struct small_mem_bitmap
+{
+    size_t words;      /**< number of words of map */
+    uint64_t *summary; /**< bit n is set when map[n] is not zero */
+    uint64_t *map;     /**< bit n is set when granule n of the heap is free */
+};
 
-    /* Get the corresponding struct small_mem_item ... */
-    mem = (struct small_mem_item *)((uint8_t *)rmem - SIZEOF_STRUCT_MEM);
-    /* ... which has to be in a used state ... */
-    small_mem = MEM_POOL(mem);
-    _ASSERT(small_mem != NULL);
-    _ASSERT(MEM_ISUSED(mem));
-    _ASSERT((uint8_t *)rmem >= (uint8_t *)small_mem->heap_ptr && (uint8_t *)rmem < (uint8_t *)small_mem->heap_end);
-    _ASSERT(MEM_POOL(&small_mem->heap_ptr[mem->next]) == small_mem);
+static size_t bitmap_control_size(size_t size)
+{
+    size_t words;
 
-    LOG_D("release memory 0x%lx, size: %ld\r\n", (uintptr_t)rmem,
-          (uintptr_t)(mem->next - ((uint8_t *)mem - small_mem->heap_ptr)));
+    words = BITMAP_WORDS(size / BITMAP_GRANULE);
 
-    /* ... and is now unused. */
-    mem->pool_ptr = MEM_FREED(small_mem);
+    return SMEM_ALIGN(sizeof(struct small_mem_bitmap), SMEM_ALIGN_SIZE) +
+           (BITMAP_WORDS(words) + words) * sizeof(uint64_t);
+}
+
+static struct small_mem_bitmap *bitmap_create(void *addr, size_t size)
+{
+    struct small_mem_bitmap *bitmap;
+
+    bitmap = (struct small_mem_bitmap *)addr;
+    bitmap->words = BITMAP_WORDS(size / BITMAP_GRANULE);
+    bitmap->summary = (uint64_t *)((uint8_t *)addr + SMEM_ALIGN(sizeof(struct small_mem_bitmap), SMEM_ALIGN_SIZE));
+    bitmap->map = bitmap->summary + BITMAP_WORDS(bitmap->words);
+    memset(bitmap->summary, 0, (BITMAP_WORDS(bitmap->words) + bitmap->words) * sizeof(uint64_t));
+
+    return bitmap;
+}
+
+/*
+ * Set or clear the bits of the granules [begin, end).
+ */
+static void bitmap_mark(struct small_mem_bitmap *bitmap, size_t begin, size_t end, int set)
+{
+    size_t word, last;
+    uint64_t mask;
+
+    if (begin >= end)
+        return;
+
+    last = (end - 1) / BITMAP_WORD_BITS;
+    for (word = begin / BITMAP_WORD_BITS; word <= last; word++)
+    {
+        mask = ~(uint64_t)0;
+        if (word == begin / BITMAP_WORD_BITS)
+            mask &= ~(uint64_t)0 << (begin % BITMAP_WORD_BITS);
+        if (word == last)
+            mask &= ~(uint64_t)0 >> (BITMAP_WORD_BITS - 1 - (end - 1) % BITMAP_WORD_BITS);
+
+        if (set)
+            bitmap->map[word] |= mask;
+        else
+            bitmap->map[word] &= ~mask;
+
+        if (bitmap->map[word] != 0)
+            bitmap->summary[word / BITMAP_WORD_BITS] |= (uint64_t)1 << (word % BITMAP_WORD_BITS);
+        else
+            bitmap->summary[word / BITMAP_WORD_BITS] &= ~((uint64_t)1 << (word % BITMAP_WORD_BITS));
+    }
+}
+
+/*
+ * Return the first free granule from pos on, or limit when there is none.
+ */
+static size_t bitmap_scan(const struct small_mem_bitmap *bitmap, size_t pos, size_t limit)
+{
+    size_t word, group;
+    uint64_t bits;
+
+    if (pos >= limit)
+        return limit;
+
+    word = pos / BITMAP_WORD_BITS;
+    bits = bitmap->map[word] & (~(uint64_t)0 << (pos % BITMAP_WORD_BITS));
+    if (bits == 0)
+    {
+        /* find the next word with a free granule through the summary */
+        word++;
+        if (word >= bitmap->words)
+            return limit;
+
+        group = word / BITMAP_WORD_BITS;
+        bits = bitmap->summary[group] & (~(uint64_t)0 << (word % BITMAP_WORD_BITS));
+        while (bits == 0)
+        {
+            group++;
+            if (group >= BITMAP_WORDS(bitmap->words))
+                return limit;
+            bits = bitmap->summary[group];
+        }
+
+        word = group * BITMAP_WORD_BITS + SMEM_FFS(bits);
+        bits = bitmap->map[word];
+    }
+
+    pos = word * BITMAP_WORD_BITS + SMEM_FFS(bits);
+
+    return pos < limit ? pos : limit;
+}
+
+/*
+ * Return the length of the run of free granules at pos, counted up to max.
+ */
+static size_t bitmap_run(const struct small_mem_bitmap *bitmap, size_t pos, size_t max)
+{
+    size_t word, run;
+    uint64_t bits;
+
+    word = pos / BITMAP_WORD_BITS;
+    run = BITMAP_WORD_BITS - pos % BITMAP_WORD_BITS;
+    bits = ~(bitmap->map[word] >> (pos % BITMAP_WORD_BITS));
+    if (bits != 0 && (size_t)SMEM_FFS(bits) < run)
+        return SMEM_FFS(bits);
+
+    for (word++; run < max && word < bitmap->words; word++)
+    {
+        bits = ~bitmap->map[word];
+        if (bits != 0)
+            return run + SMEM_FFS(bits);
+        run += BITMAP_WORD_BITS;
+    }
+
+    return run;
+}
+
+static void bitmap_insert(struct small_mem *m, struct small_mem_item *mem)
+{
+    bitmap_mark(m->bitmap, MEM_OFFSET(m, mem) / BITMAP_GRANULE, mem->next / BITMAP_GRANULE, 1);
+}
+
+static void bitmap_remove(struct small_mem *m, struct small_mem_item *mem)
+{
+    bitmap_mark(m->bitmap, MEM_OFFSET(m, mem) / BITMAP_GRANULE, mem->next / BITMAP_GRANULE, 0);
+}
+
+/*
+ * Move the marks of old to mem, only the granules which change are touched.
+ */
+static void bitmap_replace(struct small_mem *m, struct small_mem_item *old, struct small_mem_item *mem)
+{
+    size_t old_begin, old_end, begin, end;
+
+    old_begin = MEM_OFFSET(m, old) / BITMAP_GRANULE;
+    old_end = old->next / BITMAP_GRANULE;
+    begin = MEM_OFFSET(m, mem) / BITMAP_GRANULE;
+    end = mem->next / BITMAP_GRANULE;
+    if (begin >= old_end || old_begin >= end)
+    {
+        bitmap_remove(m, old);
+        bitmap_insert(m, mem);
+        return;
+    }
+
+    bitmap_mark(m->bitmap, old_begin, begin, 0);
+    bitmap_mark(m->bitmap, begin, old_begin, 1);
+    bitmap_mark(m->bitmap, end, old_end, 0);
+    bitmap_mark(m->bitmap, old_end, end, 1);
+}
+
+static struct small_mem_item *bitmap_find(struct small_mem *m, size_t size)
+{
+    struct small_mem_item *mem;
+    size_t begin, limit, need, run;
+
+    limit = MEM_OFFSET(m, m->heap_end) / BITMAP_GRANULE;
+    need = (size + SIZEOF_STRUCT_MEM + BITMAP_GRANULE - 1) / BITMAP_GRANULE;
+
+    /* no free item lies below lfree */
+    begin = 0;
+    if (MEM_BITMAPPED(m, m->lfree))
+        begin = MEM_OFFSET(m, m->lfree) / BITMAP_GRANULE;
+
+    /* every free granule found after a used one starts a free item */
+    while ((begin = bitmap_scan(m->bitmap, begin, limit)) < limit)
+    {
+        /* a run too short for the request is skipped without touching its item */
+        MEM_STAT_LOCKED(m, search_steps);
+        run = bitmap_run(m->bitmap, begin, need);
+        if (run < need)
+        {
+            begin += run;
+            continue;
+        }
+
+        mem = MEM_ITEM(m, begin * BITMAP_GRANULE);
+        if (MEM_SIZE(m, mem) >= size)
+            return mem;
+        begin = mem->next / BITMAP_GRANULE;
+    }
+
+    return NULL;
+}
+
+/*
+ * Address-ordered free list, headed by free_list[0]. Only free items are
+ * linked, so a search never steps over used items, and a merged item takes
+ * over the list slot of its free neighbour without walking the list.
+ */
+#define MEM_ORDERED(_heap, _mem)                 \
+    ((_heap)->policy >= SMEM_POLICY_FIRST_FIT || \
+     ((_heap)->policy == SMEM_POLICY_BITMAP && !MEM_BITMAPPED(_heap, _mem)))
+
+static void ordered_insert(struct small_mem *m, struct small_mem_item *mem)
+{
+    struct small_mem_link *link;
+    struct small_mem_item *prev = NULL, *next;
+
+    for (next = m->free_list[0]; next != NULL && next < mem; next = MEM_LINK(next)->next)
+        prev = next;
+
+    link = MEM_LINK(mem);
+    link->prev = prev;
+    link->next = next;
+    if (next != NULL)
+        MEM_LINK(next)->prev = mem;
+    if (prev != NULL)
+        MEM_LINK(prev)->next = mem;
+    else
+        m->free_list[0] = mem;
+}
+
+static void ordered_remove(struct small_mem *m, struct small_mem_item *mem)
+{
+    struct small_mem_link *link;
+
+    link = MEM_LINK(mem);
+    if (link->next != NULL)
+        MEM_LINK(link->next)->prev = link->prev;
+    if (link->prev != NULL)
+        MEM_LINK(link->prev)->next = link->next;
+    else
+        m->free_list[0] = link->next;
+
+    if (m->rover == mem)
+        m->rover = link->next;
+}
+
+/*
+ * Put mem in the list slot of old, no other free item may lie between them.
+ */
+static void ordered_replace(struct small_mem *m, struct small_mem_item *old, struct small_mem_item *mem)
+{
+    struct small_mem_link *link;
+
+    link = MEM_LINK(mem);
+    *link = *MEM_LINK(old);
+    if (link->next != NULL)
+        MEM_LINK(link->next)->prev = mem;
+    if (link->prev != NULL)
+        MEM_LINK(link->prev)->next = mem;
+    else
+        m->free_list[0] = mem;
+
+    if (m->rover == old)
+        m->rover = mem;
+}
+
+static struct small_mem_item *ordered_find(struct small_mem *m, size_t size)
+{
+    struct small_mem_item *mem;
+
+    for (mem = m->free_list[0]; mem != NULL; mem = MEM_LINK(mem)->next)
+    {
+        MEM_STAT_LOCKED(m, search_steps);
+        if (MEM_SIZE(m, mem) >= size)
+            return mem;
+    }
+
+    return NULL;
+}
+
+/*
+ * Search from the rover to the end of the list, then from the head up to
+ * the rover. The rover follows the found item, and a split remainder
+ * takes it over, so small blocks are spread over the heap instead of
+ * piling up at its bottom.
+ */
+static struct small_mem_item *ordered_find_next(struct small_mem *m, size_t size)
+{
+    struct small_mem_item *mem;
+
+    for (mem = m->rover; mem != NULL; mem = MEM_LINK(mem)->next)
+    {
+        MEM_STAT_LOCKED(m, search_steps);
+        if (MEM_SIZE(m, mem) >= size)
+            break;
+    }
+
+    if (mem == NULL)
+    {
+        for (mem = m->free_list[0]; mem != m->rover; mem = MEM_LINK(mem)->next)
+        {
+            MEM_STAT_LOCKED(m, search_steps);
+            if (MEM_SIZE(m, mem) >= size)
+                break;
+        }
+        if (mem == m->rover)
+            return NULL;
+    }
+
+    m->rover = mem;
+
+    return mem;
+}
+
+/*
+ * Return the smallest of the first count fitting items, every item is
+ * compared when count is 0. An exact fit ends the search early.
+ */
+static struct small_mem_item *ordered_find_best(struct small_mem *m, size_t size, size_t count)
+{
+    struct small_mem_item *mem, *best = NULL;
+    size_t mem_size, best_size = 0;
+
+    for (mem = m->free_list[0]; mem != NULL; mem = MEM_LINK(mem)->next)
+    {
+        MEM_STAT_LOCKED(m, search_steps);
+        mem_size = MEM_SIZE(m, mem);
+        if (mem_size < size)
+            continue;
+
+        if (best == NULL || mem_size < best_size)
+        {
+            best = mem;
+            best_size = mem_size;
+            /* a smaller remainder could not be split off anyway */
+            if (best_size < size + SIZEOF_STRUCT_MEM + MIN_SIZE_ALIGNED)
+                break;
+        }
+        if (count != 0 && --count == 0)
+            break;
+    }
+
+    return best;
+}
+
+static void free_insert(struct small_mem *m, struct small_mem_item *mem)
+{
+    if (MEM_BITMAPPED(m, mem))
+        bitmap_insert(m, mem);
+    else if (MEM_ORDERED(m, mem))
+        ordered_insert(m, mem);
+    else if (m->policy == SMEM_POLICY_TLSF)
+        tlsf_insert(m, mem);
+    else
+        free_list_insert(m, mem);
+}
+
+static void free_remove(struct small_mem *m, struct small_mem_item *mem)
+{
+    if (MEM_BITMAPPED(m, mem))
+        bitmap_remove(m, mem);
+    else if (MEM_ORDERED(m, mem))
+        ordered_remove(m, mem);
+    else if (m->policy == SMEM_POLICY_TLSF)
+        tlsf_remove(m, mem);
+    else
+        free_list_remove(m, mem);
+}
+
+/*
+ * Link mem in place of the indexed item old, mem must lie at or after old
+ * with no other free item in between, and old must still have its size.
+ */
+static void free_replace(struct small_mem *m, struct small_mem_item *old, struct small_mem_item *mem)
+{
+    if (MEM_BITMAPPED(m, old))
+    {
+        bitmap_replace(m, old, mem);
+        return;
+    }
+    if (MEM_ORDERED(m, old))
+    {
+        ordered_replace(m, old, mem);
+        return;
+    }
+
+    free_remove(m, old);
+    free_insert(m, mem);
+}
+
+static struct small_mem_item *free_find(struct small_mem *m, size_t size)
+{
+    struct small_mem_item *mem;
+
+    MEM_STAT_LOCKED(m, searches);
+    switch (m->policy)
+    {
+    case SMEM_POLICY_TLSF:
+        return tlsf_find(m, size);
+    case SMEM_POLICY_BITMAP:
+        /* items of added regions are kept in the address-ordered list */
+        mem = bitmap_find(m, size);
+        return mem != NULL ? mem : ordered_find(m, size);
+    case SMEM_POLICY_FIRST_FIT:
+        return ordered_find(m, size);
+    case SMEM_POLICY_NEXT_FIT:
+        return ordered_find_next(m, size);
+    case SMEM_POLICY_BEST_FIT:
+        return ordered_find_best(m, size, 0);
+    case SMEM_POLICY_GOOD_FIT:
+        return ordered_find_best(m, size, SMEM_GOOD_FIT_COUNT);
+    default:
+        return free_list_find(m, size);
+    }
+}
+
+/*
+ * Tell whether the range [begin, end) overlaps the heap or a region of it.
+ */
+static int mem_overlaps(struct small_mem *m, const void *begin, const void *end)
+{
+    struct small_mem_region *region;
+
+    if ((uintptr_t)begin < (uintptr_t)m->heap_end + SIZEOF_STRUCT_MEM && (uintptr_t)end > (uintptr_t)m->heap_ptr)
+        return 1;
+
+    for (region = m->regions; region != NULL; region = region->next)
+    {
+        if ((uintptr_t)begin < (uintptr_t)region->end + SIZEOF_STRUCT_MEM && (uintptr_t)end > (uintptr_t)region)
+            return 1;
+    }
+
+    return 0;
+}
+
+#define mem_owns(_heap, _ptr) mem_overlaps((_heap), (_ptr), (uint8_t *)(_ptr) + 1)
+
+/*
+ * Combine a free item which is not linked in any free list with its free
+ * neighbours, then link the result into the free list of its size class.
+ */
+static void plug_holes(struct small_mem *m, struct small_mem_item *mem)
+{
+    struct small_mem_item *nmem;
+    struct small_mem_item *pmem;
+    int linked;
+
+    _ASSERT(mem_owns(m, mem));
+
+    /* the granules of free neighbours stay marked, marking those of mem indexes the merged item */
+    linked = MEM_BITMAPPED(m, mem);
+    if (linked)
+        bitmap_insert(m, mem);
+
+    /* plug hole forward */
+    nmem = MEM_ITEM(m, mem->next);
+    if (mem != nmem && !MEM_ISUSED(nmem) && (uint8_t *)nmem != (uint8_t *)m->heap_end)
+    {
+        /* if mem->next is unused and not end of m->heap_ptr,
+         * combine mem and mem->next
+         */
+        if (m->lfree == nmem)
+        {
+            m->lfree = mem;
+        }
+        if (MEM_ORDERED(m, mem))
+        {
+            /* mem directly precedes nmem, it takes over the list slot of nmem */
+            ordered_replace(m, nmem, mem);
+            linked = 1;
+        }
+        else if (!MEM_BITMAPPED(m, mem))
+        {
+            free_remove(m, nmem);
+        }
+        MEM_CLEAR(nmem);
+        mem->next = nmem->next;
+        MEM_SET_PREV(MEM_ITEM(m, nmem->next), MEM_OFFSET(m, mem));
+    }
+
+    /* plug hole backward */
+    pmem = MEM_ITEM(m, MEM_PREV(mem));
+    if (pmem != mem && !MEM_ISUSED(pmem))
+    {
+        /* if mem->prev is unused, combine mem and mem->prev */
+        if (m->lfree == mem)
+        {
+            m->lfree = pmem;
+        }
+        if (MEM_ORDERED(m, mem))
+        {
+            /* pmem keeps its list slot, mem leaves the slot it took above */
+            if (linked)
+                ordered_remove(m, mem);
+            linked = 1;
+        }
+        else if (!MEM_BITMAPPED(m, mem))
+        {
+            free_remove(m, pmem);
+        }
+        MEM_CLEAR(mem);
+        pmem->next = mem->next;
+        MEM_SET_PREV(MEM_ITEM(m, mem->next), MEM_OFFSET(m, pmem));
+        mem = pmem;
+    }
+
+    if (!linked)
+        free_insert(m, mem);
+}
+
+/*
+ * Give the tail of a used item beyond size back to the heap when it is
+ * large enough to form an item of its own.
+ */
+static void mem_split(struct small_mem *m, struct small_mem_item *mem, size_t size)
+{
+    struct small_mem_item *mem2;
+    size_t ptr, ptr2;
+
+    ptr = MEM_OFFSET(m, mem);
+    if (mem->next - (ptr + SIZEOF_STRUCT_MEM) < size + SIZEOF_STRUCT_MEM + MIN_SIZE_ALIGNED)
+        return;
+
+    ptr2 = ptr + SIZEOF_STRUCT_MEM + size;
+    mem2 = MEM_ITEM(m, ptr2);
+    MEM_SET_FREED(m, mem2);
+    mem2->next = mem->next;
+    MEM_SET_PREV(mem2, ptr);
+    mem->next = ptr2;
+    if (mem2->next != m->mem_size_aligned + SIZEOF_STRUCT_MEM)
+    {
+        MEM_SET_PREV(MEM_ITEM(m, mem2->next), ptr2);
+    }
+    m->parent.used -= mem2->next - ptr2;
+
+    if (mem2 < m->lfree)
+    {
+        /* the splited struct is now the lowest */
+        m->lfree = mem2;
+    }
+
+    plug_holes(m, mem2);
+}
+
+/*
+ * Absorb the free item following the used item mem.
+ */
+static void mem_merge_next(struct small_mem *m, struct small_mem_item *mem)
+{
+    struct small_mem_item *nmem;
+
+    nmem = MEM_ITEM(m, mem->next);
+    _ASSERT(!MEM_ISUSED(nmem));
+
+    free_remove(m, nmem);
+    m->parent.used += nmem->next - mem->next;
+    if (m->lfree == nmem)
+    {
+        /* nothing below nmem->next is free any more */
+        m->lfree = MEM_ITEM(m, nmem->next);
+    }
+
+    MEM_CLEAR(nmem);
+    mem->next = nmem->next;
+    MEM_SET_PREV(MEM_ITEM(m, nmem->next), MEM_OFFSET(m, mem));
+}
+
+/*
+ * Grow the used item mem in place to newsize by absorbing the following
+ * free item, return 1 on success and 0 when the item stays unchanged.
+ */
+static int mem_expand(struct small_mem *m, struct small_mem_item *mem, size_t newsize)
+{
+    struct small_mem_item *nmem;
+
+    nmem = MEM_ITEM(m, mem->next);
+    if (MEM_ISUSED(nmem) || MEM_SIZE(m, mem) + SIZEOF_STRUCT_MEM + MEM_SIZE(m, nmem) < newsize)
+        return 0;
+
+    mem_merge_next(m, mem);
+    mem_split(m, mem, newsize);
+    if (m->parent.max < m->parent.used)
+        m->parent.max = m->parent.used;
+
+    return 1;
+}
+
+/**
+ * @brief This function will initialize small memory management algorithm.
+ *
+ * @param begin_addr the beginning address of memory.
+ *
+ * @param size is the size of the memory.
+ *
+ * @return Return a pointer to the memory object. When the return value is NULL, it means the init failed.
+ */
+smem_t smem_init(void *begin_addr, size_t size)
+{
+    return smem_init_ex(begin_addr, size, SMEM_POLICY_SEGREGATED);
+}
+
+/**
+ * @brief This function will initialize small memory management algorithm
+ *        with the specified free block placement policy.
+ *
+ * @param begin_addr the beginning address of memory.
+ *
+ * @param size is the size of the memory.
+ *
+ * @param policy is the free block placement policy. SMEM_POLICY_TLSF and
+ *        SMEM_POLICY_BITMAP reserve their index at the beginning of the memory.
+ *
+ * @return Return a pointer to the memory object. When the return value is NULL, it means the init failed.
+ */
+smem_t smem_init_ex(void *begin_addr, size_t size, enum smem_policy policy)
+{
+    struct small_mem_item *mem;
+    struct small_mem *small_mem;
+    uintptr_t staaddr, begin_align, end_align, mem_size;
+    uintptr_t index_addr;
+
+    small_mem = (struct small_mem *)SMEM_ALIGN((uintptr_t)begin_addr, SMEM_ALIGN_SIZE);
+    staaddr = (uintptr_t)small_mem + sizeof(*small_mem);
+    end_align = SMEM_ALIGN_DOWN((uintptr_t)begin_addr + size, SMEM_ALIGN_SIZE);
+
+    /* the policy index is placed between the memory object and the heap */
+    index_addr = SMEM_ALIGN(staaddr, SMEM_ALIGN_SIZE);
+    if (policy == SMEM_POLICY_TLSF && end_align > index_addr)
+        staaddr = index_addr + tlsf_control_size(end_align - index_addr);
+    else if (policy == SMEM_POLICY_BITMAP && end_align > index_addr)
+        staaddr = index_addr + bitmap_control_size(end_align - index_addr);
+    begin_align = SMEM_ALIGN((uintptr_t)staaddr, SMEM_ALIGN_SIZE);
+
+    /* alignment addr */
+    if ((end_align > (2 * SIZEOF_STRUCT_MEM + MIN_SIZE_ALIGNED)) &&
+        ((end_align - 2 * SIZEOF_STRUCT_MEM - MIN_SIZE_ALIGNED) >= begin_align))
+    {
+        /* calculate the aligned memory size */
+        mem_size = end_align - begin_align - 2 * SIZEOF_STRUCT_MEM;
+    }
+    else
+    {
+        LOG_E("mem init, error begin address 0x%lx, and end address 0x%lx\r\n", (uintptr_t)begin_addr,
+                (uintptr_t)begin_addr + size);
+
+        return NULL;
+    }
+
+#if SMEM_USING_COMPACT_HEADER
+    /* every offset of the heap has to fit the 32-bit header fields */
+    if (mem_size + 2 * SIZEOF_STRUCT_MEM > INT32_MAX)
+    {
+        LOG_E("mem init, size %ld is too large for compact headers\r\n", (long)size);
+
+        return NULL;
+    }
+    if (mem_registry_add(small_mem, small_mem, (void *)end_align) != 0)
+        return NULL;
+#endif
+
+    memset(small_mem, 0, sizeof(*small_mem));
+    /* initialize small memory object */
+    small_mem->parent.address = begin_align;
+    small_mem->parent.total = mem_size;
+    small_mem->mem_size_aligned = mem_size;
+    small_mem->region_max = mem_size;
+    small_mem->policy = policy;
+#if SMEM_USING_THREAD_SAFE
+    SMEM_LOCK_INIT(&small_mem->lock);
+    small_mem->serial = SMEM_ATOMIC_FETCH_ADD(&mem_serial, 1) + 1;
+#endif
+    if (policy == SMEM_POLICY_TLSF)
+        small_mem->tlsf = tlsf_create((void *)index_addr, mem_size);
+    if (policy == SMEM_POLICY_BITMAP)
+        small_mem->bitmap = bitmap_create((void *)index_addr, mem_size + SIZEOF_STRUCT_MEM);
+
+    /* point to begin address of heap */
+    small_mem->heap_ptr = (uint8_t *)begin_align;
+
+    LOG_D("mem init, heap begin address 0x%lx, size %ld\r\n", (uintptr_t)small_mem->heap_ptr, small_mem->mem_size_aligned);
+
+    /* initialize the start of the heap */
+    mem = (struct small_mem_item *)small_mem->heap_ptr;
+    MEM_SET_FREED(small_mem, mem);
+    mem->next = small_mem->mem_size_aligned + SIZEOF_STRUCT_MEM;
+    MEM_SET_PREV(mem, 0);
+
+    /* initialize the end of the heap */
+    small_mem->heap_end = MEM_ITEM(small_mem, mem->next);
+    MEM_SET_USED(small_mem, small_mem->heap_end);
+    small_mem->heap_end->next = small_mem->mem_size_aligned + SIZEOF_STRUCT_MEM;
+    MEM_SET_PREV(small_mem->heap_end, small_mem->mem_size_aligned + SIZEOF_STRUCT_MEM);
+
+    /* initialize the lowest-free pointer to the start of the heap */
+    small_mem->lfree = (struct small_mem_item *)small_mem->heap_ptr;
+    free_insert(small_mem, mem);
+
+    return (smem_t)(&small_mem->parent);
+}
+
+/**
+ * @brief This function will detach a small memory object, so its memory
+ *        may be reused. Blocks allocated from it become invalid.
+ *
+ * @param m the small memory management object.
+ */
+void smem_deinit(smem_t m)
+{
+    _ASSERT(m != NULL);
+
+#if SMEM_USING_COMPACT_HEADER
+    mem_registry_drop((struct small_mem *)m, NULL);
+#else
+    (void)m;
+#endif
+}
+
+/*
+ * Turn [begin_addr, begin_addr + size) into a region of the heap, return
+ * the region or NULL when it is too small or overlaps the heap.
+ */
+static struct small_mem_region *mem_add_region(struct small_mem *small_mem, void *begin_addr, size_t size)
+{
+    struct small_mem_region *region;
+    struct small_mem_item *mem, *end;
+    uintptr_t begin_align, end_align, mem_size;
+
+    region = (struct small_mem_region *)SMEM_ALIGN((uintptr_t)begin_addr, SMEM_ALIGN_SIZE);
+    begin_align = SMEM_ALIGN((uintptr_t)region + sizeof(*region), SMEM_ALIGN_SIZE);
+    end_align = SMEM_ALIGN_DOWN((uintptr_t)begin_addr + size, SMEM_ALIGN_SIZE);
+
+    if ((end_align > (2 * SIZEOF_STRUCT_MEM + MIN_SIZE_ALIGNED)) &&
+        ((end_align - 2 * SIZEOF_STRUCT_MEM - MIN_SIZE_ALIGNED) >= begin_align))
+    {
+        mem_size = end_align - begin_align - 2 * SIZEOF_STRUCT_MEM;
+    }
+    else
+    {
+        LOG_E("mem add region, error begin address 0x%lx, and end address 0x%lx\r\n", (uintptr_t)begin_addr,
+                (uintptr_t)begin_addr + size);
+
+        return NULL;
+    }
+
+    if (mem_overlaps(small_mem, region, (void *)end_align))
+    {
+        LOG_E("mem add region, 0x%lx overlaps the heap\r\n", (uintptr_t)begin_addr);
+
+        return NULL;
+    }
+
+#if SMEM_USING_COMPACT_HEADER
+    /* offsets into the region have to fit the 32-bit header fields */
+    if ((intptr_t)((uintptr_t)region - (uintptr_t)small_mem->heap_ptr) < INT32_MIN ||
+        (intptr_t)(end_align - (uintptr_t)small_mem->heap_ptr) > INT32_MAX)
+    {
+        LOG_E("mem add region, 0x%lx is out of reach of compact headers\r\n", (uintptr_t)begin_addr);
+
+        return NULL;
+    }
+    if (mem_registry_add(small_mem, region, (void *)end_align) != 0)
+        return NULL;
+#endif
+
+    /* the first item is its own previous one, like the first item of the heap */
+    mem = (struct small_mem_item *)begin_align;
+    MEM_SET_FREED(small_mem, mem);
+    MEM_SET_PREV(mem, MEM_OFFSET(small_mem, mem));
+    mem->next = MEM_PREV(mem) + SIZEOF_STRUCT_MEM + mem_size;
+
+    /* the end item is used so nothing merges across regions */
+    end = MEM_ITEM(small_mem, mem->next);
+    MEM_SET_USED(small_mem, end);
+    end->next = mem->next;
+    MEM_SET_PREV(end, mem->next);
+
+    region->end = end;
+    region->base = NULL;
+    region->size = 0;
+    region->next = small_mem->regions;
+    small_mem->regions = region;
+
+    small_mem->parent.total += mem_size;
+    if (small_mem->region_max < mem_size)
+        small_mem->region_max = mem_size;
+    if (mem < small_mem->lfree)
+        small_mem->lfree = mem;
+    free_insert(small_mem, mem);
+
+    LOG_D("mem add region, begin address 0x%lx, size %ld\r\n", (uintptr_t)begin_align, (long)mem_size);
+
+    return region;
+}
+
+/*
+ * Map a new region holding at least one item of size through the grow
+ * callback, return 1 on success.
+ */
+static int mem_grow(struct small_mem *small_mem, size_t size)
+{
+    struct small_mem_region *region;
+    size_t need, actual = 0;
+    void *addr;
+
+    if (small_mem->grow == NULL)
+        return 0;
+
+    /* the region descriptor, the first item, the end item and the alignment slack */
+    need = SMEM_ALIGN(sizeof(struct small_mem_region), SMEM_ALIGN_SIZE) + 2 * SIZEOF_STRUCT_MEM + size + SMEM_ALIGN_SIZE;
+    if (need < SMEM_GROW_MIN_SIZE)
+        need = SMEM_GROW_MIN_SIZE;
+
+    addr = small_mem->grow(need, &actual, small_mem->provider_arg);
+    if (addr == NULL)
+    {
+        LOG_D("mem grow, no memory from the provider\r\n");
+        return 0;
+    }
+
+    region = mem_add_region(small_mem, addr, actual);
+    if (region == NULL)
+    {
+        if (small_mem->trim != NULL)
+            small_mem->trim(addr, actual, small_mem->provider_arg);
+        return 0;
+    }
+    region->base = addr;
+    region->size = actual;
+
+    return 1;
+}
+
+/*
+ * Find a free item of at least size, growing the heap when there is none.
+ */
+static struct small_mem_item *mem_find(struct small_mem *small_mem, size_t size)
+{
+    struct small_mem_item *mem;
+
+    mem = free_find(small_mem, size);
+    if (mem == NULL && mem_grow(small_mem, size))
+        mem = free_find(small_mem, size);
+
+    return mem;
+}
+
+/**
+ * @brief This function will add a memory region to a small memory object,
+ *        allocation searches all regions of the object afterwards.
+ *
+ * @param m the small memory management object.
+ *
+ * @param begin_addr the beginning address of the region.
+ *
+ * @param size is the size of the region.
+ *
+ * @return 0 on success, -1 when the region is too small or overlaps the object.
+ */
+int smem_add_region(smem_t m, void *begin_addr, size_t size)
+{
+    struct small_mem *small_mem;
+    struct small_mem_region *region;
+
+    _ASSERT(m != NULL);
+
+    small_mem = (struct small_mem *)m;
+    MEM_LOCK(small_mem);
+    region = mem_add_region(small_mem, begin_addr, size);
+    MEM_UNLOCK(small_mem);
+
+    return region != NULL ? 0 : -1;
+}
+
+/**
+ * @brief This function will set the page provider a small memory object grows
+ *        through when it runs out of memory, e.g. smem_port_page_alloc and
+ *        smem_port_page_free. Call it right after init.
+ *
+ * @param m the small memory management object.
+ *
+ * @param grow maps a new region, NULL disables the growth.
+ *
+ * @param trim unmaps a region returned by grow, used by smem_trim.
+ *
+ * @param arg is passed to both callbacks.
+ */
+void smem_set_provider(smem_t m, smem_grow_t grow, smem_trim_t trim, void *arg)
+{
+    struct small_mem *small_mem;
+
+    _ASSERT(m != NULL);
+
+    small_mem = (struct small_mem *)m;
+    MEM_LOCK(small_mem);
+    small_mem->grow = grow;
+    small_mem->trim = trim;
+    small_mem->provider_arg = arg;
+    MEM_UNLOCK(small_mem);
+}
+
+#if SMEM_USING_HOOK
+/**
+ * @brief This function will set the hooks a small memory object calls around
+ *        its allocations, resizes and releases, the batch calls report every
+ *        block and smem_compact reports moved handle blocks. An operation
+ *        runs without a time stamp when both hooks are NULL. Call it while no
+ *        other thread uses the heap.
+ *
+ * @param m the small memory management object.
+ *
+ * @param pre is called before every operation, NULL for none.
+ *
+ * @param post is called after every operation, NULL for none.
+ *
+ * @param tag is passed to both hooks.
+ */
+void smem_set_hooks(smem_t m, smem_hook_t pre, smem_hook_t post, void *tag)
+{
+    struct small_mem *small_mem;
+
+    _ASSERT(m != NULL);
+
+    small_mem = (struct small_mem *)m;
+    MEM_LOCK(small_mem);
+    small_mem->hook_pre = pre;
+    small_mem->hook_post = post;
+    small_mem->hook_tag = tag;
+    MEM_UNLOCK(small_mem);
+}
+#endif
+
+/**
+ * @brief This function will give the regions mapped by the grow callback
+ *        which hold no used block back through the trim callback.
+ *
+ * @param m the small memory management object.
+ *
+ * @return the number of bytes given back.
+ */
+size_t smem_trim(smem_t m)
+{
+    struct small_mem *small_mem;
+    struct small_mem_region *region, **pregion;
+    struct small_mem_item *mem;
+    size_t released = 0;
+    int lfree_lost = 0;
+
+    _ASSERT(m != NULL);
+
+    small_mem = (struct small_mem *)m;
+    MEM_LOCK(small_mem);
+    if (small_mem->trim == NULL)
+    {
+        MEM_UNLOCK(small_mem);
+        return 0;
+    }
+
+    pregion = &small_mem->regions;
+    while (*pregion != NULL)
+    {
+        region = *pregion;
+        mem = MEM_REGION_FIRST(region);
+        if (region->size == 0 || MEM_ISUSED(mem) || MEM_ITEM(small_mem, mem->next) != region->end)
+        {
+            pregion = &region->next;
+            continue;
+        }
+
+        free_remove(small_mem, mem);
+        if (small_mem->lfree == mem)
+            lfree_lost = 1;
+        small_mem->parent.total -= MEM_SIZE(small_mem, mem);
+        *pregion = region->next;
+#if SMEM_USING_COMPACT_HEADER
+        mem_registry_drop(small_mem, region);
+#endif
+        released += region->size;
+        small_mem->trim(region->base, region->size, small_mem->provider_arg);
+    }
+
+    if (lfree_lost)
+    {
+        /* the lowest region start is a lower bound of every free item */
+        small_mem->lfree = (struct small_mem_item *)small_mem->heap_ptr;
+        for (region = small_mem->regions; region != NULL; region = region->next)
+        {
+            mem = MEM_REGION_FIRST(region);
+            if (mem < small_mem->lfree)
+                small_mem->lfree = mem;
+        }
+    }
+    MEM_UNLOCK(small_mem);
+
+    return released;
+}
+
+static void *mem_alloc(struct small_mem *small_mem, size_t size)
+{
+    size_t ptr, ptr2;
+    struct small_mem_item *mem, *mem2;
+
+    /* only free items of a suitable size class are visited */
+    mem = mem_find(small_mem, size);
+    if (mem == NULL)
+    {
+        LOG_D("no memory\r\n");
+        return NULL;
+    }
+
+    ptr = MEM_OFFSET(small_mem, mem);
+    if (mem->next - (ptr + SIZEOF_STRUCT_MEM) >= (size + SIZEOF_STRUCT_MEM + MIN_SIZE_ALIGNED))
+    {
+        /* (in addition to the above, we test if another struct small_mem_item (SIZEOF_STRUCT_MEM) containing
+         * at least MIN_SIZE_ALIGNED of data also fits in the 'user data space' of 'mem')
+         * -> split large block, create empty remainder,
+         * remainder must be large enough to contain MIN_SIZE_ALIGNED data: if
+         * mem->next - (ptr + (2*SIZEOF_STRUCT_MEM)) == size,
+         * struct small_mem_item would fit in but no data between mem2 and mem2->next
+         * @todo we could leave out MIN_SIZE_ALIGNED. We would create an empty
+         *       region that couldn't hold data, but when mem->next gets freed,
+         *       the 2 regions would be combined, resulting in more free memory
+         */
+        ptr2 = ptr + SIZEOF_STRUCT_MEM + size;
+
+        /* create mem2 struct */
+        mem2 = MEM_ITEM(small_mem, ptr2);
+        MEM_SET_FREED(small_mem, mem2);
+        mem2->next = mem->next;
+        MEM_SET_PREV(mem2, ptr);
+
+        /* the remainder takes the place of mem in the free index */
+        free_replace(small_mem, mem, mem2);
+
+        /* and insert it between mem and mem->next */
+        mem->next = ptr2;
+
+        if (mem2->next != small_mem->mem_size_aligned + SIZEOF_STRUCT_MEM)
+        {
+            MEM_SET_PREV(MEM_ITEM(small_mem, mem2->next), ptr2);
+        }
+
+        small_mem->parent.used += (size + SIZEOF_STRUCT_MEM);
+        if (small_mem->parent.max < small_mem->parent.used)
+            small_mem->parent.max = small_mem->parent.used;
+    }
+    else
+    {
+        /* (a mem2 struct does no fit into the user data space of mem and mem->next will always
+         * be used at this point: if not we have 2 unused structs in a row, plug_holes should have
+         * take care of this).
+         * -> near fit or excact fit: do not split, no mem2 creation
+         * also can't move mem->next directly behind mem, since mem->next
+         * will always be used at this point!
+         */
+        free_remove(small_mem, mem);
+        small_mem->parent.used += mem->next - (MEM_OFFSET(small_mem, mem));
+        if (small_mem->parent.max < small_mem->parent.used)
+            small_mem->parent.max = small_mem->parent.used;
+    }
+    /* set small memory object */
+    MEM_SET_USED(small_mem, mem);
+
+    if (mem == small_mem->lfree)
+    {
+        /* nothing below mem->next is free now, which keeps lfree a valid lower bound */
+        small_mem->lfree = MEM_ITEM(small_mem, mem->next);
+    }
+    _ASSERT(MEM_SIZE(small_mem, mem) >= size);
+    _ASSERT((uintptr_t)((uint8_t *)mem + SIZEOF_STRUCT_MEM) % SMEM_ALIGN_SIZE == 0);
+    _ASSERT((((uintptr_t)mem) & (SMEM_ALIGN_SIZE - 1)) == 0);
+
+    LOG_I("allocate memory at 0x%lx, size: %ld\r\n", (uintptr_t)((uint8_t *)mem + SIZEOF_STRUCT_MEM),
+          (uintptr_t)(mem->next - (MEM_OFFSET(small_mem, mem))));
+
+    /* return the memory data except mem struct */
+    return (uint8_t *)mem + SIZEOF_STRUCT_MEM;
+}
+
+static void mem_free(struct small_mem *small_mem, struct small_mem_item *mem)
+{
+    _ASSERT(MEM_POOL(MEM_ITEM(small_mem, mem->next)) == small_mem);
+
+    LOG_D("release memory 0x%lx, size: %ld\r\n", (uintptr_t)((uint8_t *)mem + SIZEOF_STRUCT_MEM),
+          (uintptr_t)(mem->next - (MEM_OFFSET(small_mem, mem))));
+
+    /* mem is now unused */
+    MEM_SET_FREED(small_mem, mem);
+    if (mem == small_mem->compact)
+        small_mem->compact = NULL;
+
+    if (mem < small_mem->lfree)
+    {
+        /* the newly freed struct is now the lowest */
+        small_mem->lfree = mem;
+    }
+
+    small_mem->parent.used -= (mem->next - (MEM_OFFSET(small_mem, mem)));
+
+    /* finally, see if prev or next are free also */
+    plug_holes(small_mem, mem);
+}
+
+/*
+ * A handle refers to a movable block, the block keeps the address of its
+ * handle in front of the user data so the block can update it when it
+ * moves. Unused handles are linked through mem.
+ */
+struct smem_handle
+{
+    struct small_mem_item *mem; /**< block of the handle, next unused handle while the handle is unused */
+    struct small_mem *heap;     /**< heap of the handle */
+    size_t locks;               /**< smem_hlock nesting count, the block does not move while it is not 0 */
+};
+
+#define HANDLE_HEAD SMEM_ALIGN(sizeof(struct smem_handle *), SMEM_ALIGN_SIZE)
+#define HANDLE_OF(_mem) (*(struct smem_handle **)((uint8_t *)(_mem) + SIZEOF_STRUCT_MEM))
+
+/*
+ * Take an unused handle, a chunk of SMEM_HANDLE_CHUNK handles is carved from
+ * the heap when none is left. Chunks stay in the heap until it is dropped.
+ */
+static struct smem_handle *handle_get(struct small_mem *m)
+{
+    struct smem_handle *handle;
+    size_t i;
+
+    if (m->handle_free == NULL)
+    {
+        handle = (struct smem_handle *)mem_alloc(m, SMEM_ALIGN(SMEM_HANDLE_CHUNK * sizeof(*handle), SMEM_ALIGN_SIZE));
+        if (handle == NULL)
+            return NULL;
+
+        for (i = 0; i < SMEM_HANDLE_CHUNK; i++)
+        {
+            handle[i].mem = (struct small_mem_item *)m->handle_free;
+            handle[i].heap = m;
+            handle[i].locks = 0;
+            m->handle_free = &handle[i];
+        }
+    }
+
+    handle = m->handle_free;
+    m->handle_free = (struct smem_handle *)handle->mem;
+
+    return handle;
+}
+
+#if SMEM_USING_HOOK
+/* report a handle block moved by compaction to the post hook, the heap lock is held */
+static void mem_hook_move(struct small_mem *m, struct small_mem_item *mem, struct small_mem_item *old)
+{
+    struct smem_hook_info info;
+
+    info.op = SMEM_HOOK_MOVE;
+    info.ptr = (uint8_t *)mem + SIZEOF_STRUCT_MEM;
+    info.old_ptr = (uint8_t *)old + SIZEOF_STRUCT_MEM;
+    info.size = info.rounded = MEM_SIZE(m, mem);
+    info.align = 0;
+    info.cycles = 0;
+    info.seq = MEM_SEQ_NEXT(m);
+    m->hook_post(m, &info, m->hook_tag);
+}
+#endif
+
+/*
+ * Slide the movable item mem down into the free item fmem right below it,
+ * the free space moves above mem and merges with a free item there. Return
+ * the free item above the moved item.
+ */
+static struct small_mem_item *mem_slide(struct small_mem *m, struct small_mem_item *fmem, struct small_mem_item *mem)
+{
+    struct small_mem_item *old;
+    size_t prev, next, size;
+    int lowest;
+
+    prev = MEM_PREV(fmem);
+    next = mem->next;
+    size = mem->next - MEM_OFFSET(m, mem);
+    lowest = m->lfree == fmem;
+
+    /* the links of fmem live in the space mem moves to */
+    free_remove(m, fmem);
+    memmove(fmem, mem, size);
+
+    old = mem;
+    mem = fmem;
+    mem->next = MEM_OFFSET(m, mem) + size;
+    MEM_SET_PREV(mem, prev);
+    HANDLE_OF(mem)->mem = mem;
+
+    fmem = MEM_ITEM(m, mem->next);
+    MEM_CLEAR(fmem);
+    MEM_SET_FREED(m, fmem);
+    fmem->next = next;
+    MEM_SET_PREV(fmem, MEM_OFFSET(m, mem));
+    MEM_SET_PREV(MEM_ITEM(m, next), MEM_OFFSET(m, fmem));
+    if (lowest)
+        m->lfree = fmem;
+
+    plug_holes(m, fmem);
+
+#if SMEM_USING_HOOK
+    if (m->hook_post != NULL)
+        mem_hook_move(m, mem, old);
+#else
+    (void)old;
+#endif
+
+    return fmem;
+}
+
+/*
+ * Slide the unlocked movable items of the initial heap down over the free
+ * items below them, visiting at most budget items. A step starts where the
+ * previous one stopped, or from the lowest free item once a pass is done.
+ * Return the number of items moved.
+ */
+static size_t mem_compact(struct small_mem *m, size_t budget)
+{
+    struct small_mem_item *mem, *nmem;
+    size_t moved = 0;
+
+    mem = m->lfree;
+    if ((uint8_t *)mem < m->heap_ptr || mem >= m->heap_end)
+        mem = (struct small_mem_item *)m->heap_ptr;
+    /* nothing below lfree is free, the cursor is only worth it above */
+    if (m->compact != NULL && m->compact > mem)
+        mem = m->compact;
+
+    for (; budget != 0 && mem != m->heap_end; budget--)
+    {
+        if (MEM_ISUSED(mem))
+        {
+            mem = MEM_ITEM(m, mem->next);
+            continue;
+        }
+
+        /* free items are merged, the next one is used or the end */
+        nmem = MEM_ITEM(m, mem->next);
+        if (nmem == m->heap_end)
+        {
+            mem = nmem;
+            break;
+        }
+
+        if (MEM_ISMOVABLE(nmem) && HANDLE_OF(nmem)->locks == 0)
+        {
+            mem = mem_slide(m, mem, nmem);
+            moved++;
+        }
+        else
+        {
+            mem = MEM_ITEM(m, nmem->next);
+        }
+    }
+
+    /*
+     * The cursor is kept on a used item, a free item may merge away before
+     * the next step. Freeing the cursor item clears it.
+     */
+    if (mem != m->heap_end && !MEM_ISUSED(mem))
+        mem = MEM_ITEM(m, MEM_PREV(mem));
+    m->compact = mem != m->heap_end && MEM_ISUSED(mem) ? mem : NULL;
+
+    return moved;
+}
+
+static void *mem_realloc(struct small_mem *small_mem, struct small_mem_item *mem, size_t newsize)
+{
+    size_t size, avail;
+    struct small_mem_item *pmem, *nmem;
+    void *rmem, *nptr;
+
+    rmem = (uint8_t *)mem + SIZEOF_STRUCT_MEM;
+
+    /* current memory block size */
+    size = MEM_SIZE(small_mem, mem);
+    if (size == newsize)
+    {
+        /* the size is the same as */
+        return rmem;
+    }
+
+    if (newsize < size)
+    {
+        /* split memory block */
+        mem_split(small_mem, mem, newsize);
+
+        return rmem;
+    }
+
+    /* expand in place when the next block is free and large enough */
+    if (mem_expand(small_mem, mem, newsize))
+        return rmem;
+
+    /* expand downwards into a free previous block and move the data */
+    nmem = MEM_ITEM(small_mem, mem->next);
+    pmem = MEM_ITEM(small_mem, MEM_PREV(mem));
+    if (pmem != mem && !MEM_ISUSED(pmem))
+    {
+        avail = MEM_SIZE(small_mem, pmem) + SIZEOF_STRUCT_MEM + size;
+        if (!MEM_ISUSED(nmem))
+            avail += SIZEOF_STRUCT_MEM + MEM_SIZE(small_mem, nmem);
+
+        if (avail >= newsize)
+        {
+            if (!MEM_ISUSED(nmem))
+                mem_merge_next(small_mem, mem);
+
+            free_remove(small_mem, pmem);
+            if (mem == small_mem->compact)
+                small_mem->compact = pmem;
+            small_mem->parent.used += (uint8_t *)mem - (uint8_t *)pmem;
+            MEM_SET_USED(small_mem, pmem);
+            pmem->next = mem->next;
+            MEM_SET_PREV(MEM_ITEM(small_mem, mem->next), MEM_OFFSET(small_mem, pmem));
+            if (small_mem->lfree == pmem)
+            {
+                /* nothing below pmem->next is free any more */
+                small_mem->lfree = MEM_ITEM(small_mem, pmem->next);
+            }
+
+            /* the old header lies inside the new user data, it is overwritten here */
+            nptr = (uint8_t *)pmem + SIZEOF_STRUCT_MEM;
+            memmove(nptr, rmem, size);
+
+            mem_split(small_mem, pmem, newsize);
+            if (small_mem->parent.max < small_mem->parent.used)
+                small_mem->parent.max = small_mem->parent.used;
+
+            return nptr;
+        }
+    }
+
+    /* expand memory */
+    nptr = mem_alloc(small_mem, newsize);
+    if (nptr != NULL) /* check memory */
+    {
+        memcpy(nptr, rmem, size < newsize ? size : newsize);
+        mem_free(small_mem, mem);
+    }
+
+    return nptr;
+}
+
+/*
+ * Allocate size bytes aligned at align. The leading slack becomes a free
+ * item of its own, so the block is over-allocated by enough to leave either
+ * no slack or room for a whole item in front of the aligned header.
+ */
+static void *mem_memalign(struct small_mem *small_mem, size_t align, size_t size)
+{
+    struct small_mem_item *mem, *amem;
+    uintptr_t rmem, aligned;
+    size_t ptr, aptr;
+
+    rmem = (uintptr_t)mem_alloc(small_mem, size + align + SIZEOF_STRUCT_MEM + MIN_SIZE_ALIGNED);
+    if (rmem == 0)
+        return NULL;
+
+    aligned = SMEM_ALIGN(rmem, align);
+    if (aligned == rmem)
+    {
+        mem = (struct small_mem_item *)(rmem - SIZEOF_STRUCT_MEM);
+        mem_split(small_mem, mem, size);
+
+        return (void *)rmem;
+    }
+
+    /* the slack must hold an item of its own */
+    aligned = SMEM_ALIGN(rmem + SIZEOF_STRUCT_MEM + MIN_SIZE_ALIGNED, align);
+
+    mem = (struct small_mem_item *)(rmem - SIZEOF_STRUCT_MEM);
+    amem = (struct small_mem_item *)(aligned - SIZEOF_STRUCT_MEM);
+    ptr = MEM_OFFSET(small_mem, mem);
+    aptr = MEM_OFFSET(small_mem, amem);
+
+    /* insert the aligned item between mem and mem->next */
+    MEM_SET_USED(small_mem, amem);
+    amem->next = mem->next;
+    MEM_SET_PREV(amem, ptr);
+    mem->next = aptr;
+    if (amem->next != small_mem->mem_size_aligned + SIZEOF_STRUCT_MEM)
+    {
+        MEM_SET_PREV(MEM_ITEM(small_mem, amem->next), aptr);
+    }
+
+    /* give the leading slack and the unused tail back */
+    mem_free(small_mem, mem);
+    mem_split(small_mem, amem, size);
+
+    _ASSERT(aligned + size <= (uintptr_t)amem + SIZEOF_STRUCT_MEM + MEM_SIZE(small_mem, amem));
+
+    return (void *)aligned;
+}
+
+/*
+ * Carve up to n blocks of size from as few free items as possible, the
+ * blocks of one item are adjacent and only its tail goes back to the index.
+ */
+static size_t mem_alloc_batch(struct small_mem *small_mem, size_t size, size_t n, void **out)
+{
+    struct small_mem_item *mem, *mem2;
+    size_t count = 0, ptr, ptr2, begin, end;
+
+    while (count < n)
+    {
+        mem = mem_find(small_mem, size);
+        if (mem == NULL)
+        {
+            LOG_D("no memory\r\n");
+            break;
+        }
+        free_remove(small_mem, mem);
+
+        begin = ptr = MEM_OFFSET(small_mem, mem);
+        end = mem->next;
+        if (mem == small_mem->lfree)
+        {
+            /* nothing below end is free now, mem_split lowers it to the tail */
+            small_mem->lfree = MEM_ITEM(small_mem, end);
+        }
+
+        for (;;)
+        {
+            MEM_SET_USED(small_mem, mem);
+            out[count++] = (uint8_t *)mem + SIZEOF_STRUCT_MEM;
+            if (count == n || end - ptr < 2 * (SIZEOF_STRUCT_MEM + size))
+                break;
+
+            /* the next block starts right behind this one */
+            ptr2 = ptr + SIZEOF_STRUCT_MEM + size;
+            mem2 = MEM_ITEM(small_mem, ptr2);
+            mem2->next = end;
+            MEM_SET_PREV(mem2, ptr);
+            mem->next = ptr2;
+            mem = mem2;
+            ptr = ptr2;
+        }
+        if (end != small_mem->mem_size_aligned + SIZEOF_STRUCT_MEM)
+        {
+            MEM_SET_PREV(MEM_ITEM(small_mem, end), ptr);
+        }
+
+        small_mem->parent.used += end - begin;
+        mem_split(small_mem, mem, size);
+        if (small_mem->parent.max < small_mem->parent.used)
+            small_mem->parent.max = small_mem->parent.used;
+    }
+
+    return count;
+}
+
+/*
+ * Release the used items of an address ordered array, runs of adjacent
+ * items are combined first so plug_holes runs once per run.
+ */
+static void mem_free_batch(struct small_mem *small_mem, void **ptrs, size_t n)
+{
+    struct small_mem_item *mem, *nmem;
+    size_t i;
+
+    i = 0;
+    while (i < n)
+    {
+        mem = (struct small_mem_item *)((uint8_t *)ptrs[i++] - SIZEOF_STRUCT_MEM);
+        _ASSERT(MEM_POOL(MEM_ITEM(small_mem, mem->next)) == small_mem);
+
+        MEM_SET_FREED(small_mem, mem);
+        small_mem->parent.used -= (mem->next - (MEM_OFFSET(small_mem, mem)));
+        if (mem == small_mem->compact)
+            small_mem->compact = NULL;
+
+        while (i < n && (uint8_t *)ptrs[i] - SIZEOF_STRUCT_MEM == (uint8_t *)MEM_ITEM(small_mem, mem->next))
+        {
+            nmem = (struct small_mem_item *)((uint8_t *)ptrs[i++] - SIZEOF_STRUCT_MEM);
+            _ASSERT(MEM_ISUSED(nmem));
+            small_mem->parent.used -= (nmem->next - mem->next);
+            if (nmem == small_mem->compact)
+                small_mem->compact = NULL;
+            MEM_CLEAR(nmem);
+            mem->next = nmem->next;
+            MEM_SET_PREV(MEM_ITEM(small_mem, mem->next), MEM_OFFSET(small_mem, mem));
+        }
+
+        if (mem < small_mem->lfree)
+        {
+            /* the newly freed struct is now the lowest */
+            small_mem->lfree = mem;
+        }
+        plug_holes(small_mem, mem);
+    }
+}
+
+static int mem_ptr_compare(const void *a, const void *b)
+{
+    uintptr_t pa = (uintptr_t)*(void *const *)a;
+    uintptr_t pb = (uintptr_t)*(void *const *)b;
+
+    return (pa > pb) - (pa < pb);
+}
+
+#if SMEM_USING_THREAD_SAFE && (SMEM_TCACHE_MAX_SIZE > 0)
+/*
+ * Per-thread cache of recently freed blocks. Cached blocks stay used in the
+ * heap and are kept in one singly linked bin per user data size, so a hit
+ * never takes the heap lock. A thread caches blocks of one heap at a time.
+ */
+#define TCACHE_BIN_NUM (SMEM_TCACHE_MAX_SIZE / SMEM_ALIGN_SIZE)
+
+struct small_mem_tcache
+{
+    struct small_mem *heap;                      /**< heap of the cached blocks */
+    uint32_t serial;                             /**< serial of the heap, tells a re-initialized heap apart */
+    uint32_t total;                              /**< number of cached blocks */
+    uint8_t count[TCACHE_BIN_NUM];               /**< number of cached blocks per bin */
+    struct small_mem_item *bins[TCACHE_BIN_NUM]; /**< bin n caches blocks of (n + 1) * SMEM_ALIGN_SIZE */
+};
+
+static SMEM_THREAD_LOCAL struct small_mem_tcache tcache;
+
+#ifdef SMEM_PORT_PTHREAD
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+static void tcache_exit(void *arg)
+{
+    (void)arg;
+    smem_tcache_flush();
+}
+
+static void tcache_key_create(void)
+{
+    pthread_key_create(&tcache_key, tcache_exit);
+}
+#endif
+
+static void *tcache_pop(struct small_mem *m, size_t size)
+{
+    struct small_mem_item *mem;
+    size_t bin;
+
+    if (tcache.heap != m || tcache.serial != m->serial || size > SMEM_TCACHE_MAX_SIZE)
+        return NULL;
+
+    bin = size / SMEM_ALIGN_SIZE - 1;
+    mem = tcache.bins[bin];
+    if (mem == NULL)
+        return NULL;
+
+    tcache.bins[bin] = MEM_LINK(mem)->next;
+    tcache.count[bin]--;
+    tcache.total--;
+
+    return (uint8_t *)mem + SIZEOF_STRUCT_MEM;
+}
+
+static int tcache_push(struct small_mem *m, struct small_mem_item *mem)
+{
+    size_t size, bin;
+
+    size = MEM_SIZE(m, mem);
+    if (size > SMEM_TCACHE_MAX_SIZE)
+        return 0;
+
+    if (tcache.heap != m || tcache.serial != m->serial)
+    {
+        /* blocks of a heap which has been initialized again are gone, drop them */
+        if (tcache.heap != m && tcache.total != 0)
+            return 0;
+
+        memset(&tcache, 0, sizeof(tcache));
+        tcache.heap = m;
+        tcache.serial = m->serial;
+#ifdef SMEM_PORT_PTHREAD
+        pthread_once(&tcache_once, tcache_key_create);
+        pthread_setspecific(tcache_key, &tcache);
+#endif
+    }
+
+    bin = size / SMEM_ALIGN_SIZE - 1;
+    if (tcache.count[bin] >= SMEM_TCACHE_COUNT)
+        return 0;
+
+    MEM_LINK(mem)->next = tcache.bins[bin];
+    tcache.bins[bin] = mem;
+    tcache.count[bin]++;
+    tcache.total++;
+
+    return 1;
+}
+#else
+#define tcache_pop(_heap, _size) ((void *)0)
+#define tcache_push(_heap, _mem) (0)
+#endif
+
+#if SMEM_USING_QUICK_LIST
+/*
+ * Quick lists of a heap, freed blocks wait on them without being merged with
+ * their neighbours. They stay used items of the heap but are not counted in
+ * its used size. List n holds blocks of (n + 1) * SMEM_ALIGN_SIZE, so a
+ * request of that size takes one without a search. Called with the heap lock
+ * held.
+ */
+#define QUICK_LIST_NUM (SMEM_QUICK_MAX_SIZE / SMEM_ALIGN_SIZE)
+
+static void *quick_pop(struct small_mem *m, size_t size)
+{
+    struct small_mem_item *mem;
+    size_t list;
+
+    if (size > SMEM_QUICK_MAX_SIZE)
+        return NULL;
+
+    list = size / SMEM_ALIGN_SIZE - 1;
+    mem = m->quick[list];
+    if (mem == NULL)
+        return NULL;
+
+    m->quick[list] = MEM_LINK(mem)->next;
+    m->quick_count--;
+    m->parent.used += mem->next - MEM_OFFSET(m, mem);
+
+    return (uint8_t *)mem + SIZEOF_STRUCT_MEM;
+}
+
+/* merge every waiting block into the heap, return the number of blocks merged */
+static size_t quick_drain(struct small_mem *m)
+{
+    struct small_mem_item *mem, *next;
+    size_t list, count;
+
+    count = m->quick_count;
+    for (list = 0; list < QUICK_LIST_NUM && m->quick_count != 0; list++)
+    {
+        for (mem = m->quick[list]; mem != NULL; mem = next)
+        {
+            next = MEM_LINK(mem)->next;
+            /* mem_free takes the size off the used size once more */
+            m->parent.used += mem->next - MEM_OFFSET(m, mem);
+            mem_free(m, mem);
+            m->quick_count--;
+        }
+        m->quick[list] = NULL;
+    }
+
+    return count;
+}
+
+static int quick_push(struct small_mem *m, struct small_mem_item *mem)
+{
+    size_t size, list;
+
+    size = MEM_SIZE(m, mem);
+    if (size > SMEM_QUICK_MAX_SIZE)
+        return 0;
+
+    if (m->quick_count >= SMEM_QUICK_THRESHOLD)
+        quick_drain(m);
+
+    list = size / SMEM_ALIGN_SIZE - 1;
+    MEM_LINK(mem)->next = m->quick[list];
+    m->quick[list] = mem;
+    m->quick_count++;
+    m->parent.used -= mem->next - MEM_OFFSET(m, mem);
+
+    return 1;
+}
+#else
+#define quick_pop(_heap, _size) ((void *)0)
+#define quick_push(_heap, _mem) (0)
+#define quick_drain(_heap) (0)
+#endif
+
+#if SMEM_USING_REMOTE_FREE
+/*
+ * Remote free queue of a heap, a lock-free stack the threads which do not own
+ * the heap push their freed blocks onto. The blocks stay used until a thread
+ * holding the heap lock takes the whole stack and releases them, so the lock
+ * makes that thread the single consumer and taking all at once avoids ABA.
+ */
+static void remote_push(struct small_mem *m, struct small_mem_item *first, struct small_mem_item *last)
+{
+    struct small_mem_item *head;
+
+    head = SMEM_ATOMIC_LOAD_PTR(&m->remote);
+    do
+    {
+        MEM_LINK(last)->next = head;
+    } while (!SMEM_ATOMIC_CAS_PTR(&m->remote, &head, first));
+}
+
+/* release every queued block, return the number of blocks */
+static size_t remote_drain(struct small_mem *m)
+{
+    struct small_mem_item *mem, *next;
+    size_t count = 0;
+
+    if (SMEM_ATOMIC_LOAD_PTR(&m->remote) == NULL)
+        return 0;
+
+    for (mem = SMEM_ATOMIC_XCHG_PTR(&m->remote, NULL); mem != NULL; mem = next)
+    {
+        next = MEM_LINK(mem)->next;
+        if (!quick_push(m, mem))
+            mem_free(m, mem);
+        count++;
+    }
+
+    return count;
+}
+#else
+#define remote_drain(_heap) ((size_t)0)
+#endif
+
+/**
+ * @brief Allocate a block of memory, the body of smem_alloc.
+ *
+ * @param small_mem the small memory management object.
+ *
+ * @param size is the minimum size of the requested block in bytes.
+ *
+ * @return the pointer to allocated memory or NULL if no free memory was found.
+ */
+static void *mem_alloc_entry(struct small_mem *small_mem, size_t size)
+{
+    void *ptr;
+
+    if (size == 0)
+        return NULL;
+
+    /* alignment size */
+    size = SMEM_ALIGN(size, SMEM_ALIGN_SIZE);
+
+    /* every data block must be at least MIN_SIZE_ALIGNED long */
+    if (size < MIN_SIZE_ALIGNED)
+        size = MIN_SIZE_ALIGNED;
+
+    if (size > MEM_SIZE_MAX(small_mem))
+    {
+        LOG_D("no memory\r\n");
+        MEM_STAT_INC(small_mem, failed_count);
+        return NULL;
+    }
+
+    ptr = tcache_pop(small_mem, size);
+    if (ptr != NULL)
+    {
+        MEM_SEQ(small_mem);
+        MEM_STAT_INC(small_mem, alloc_count);
+        return ptr;
+    }
+
+    MEM_LOCK(small_mem);
+    (void)remote_drain(small_mem);
+    ptr = quick_pop(small_mem, size);
+    if (ptr == NULL)
+        ptr = mem_alloc(small_mem, size);
+    /* the waiting blocks may be what is missing once they are merged */
+    if (ptr == NULL && quick_drain(small_mem) != 0)
+        ptr = mem_alloc(small_mem, size);
+    MEM_SEQ(small_mem);
+    MEM_UNLOCK(small_mem);
+
+#if SMEM_USING_THREAD_SAFE && (SMEM_TCACHE_MAX_SIZE > 0)
+    if (ptr == NULL && tcache.heap == small_mem && tcache.total != 0)
+    {
+        /* the blocks held by this thread may be what is missing */
+        smem_tcache_flush();
+        MEM_LOCK(small_mem);
+        ptr = mem_alloc(small_mem, size);
+        MEM_SEQ(small_mem);
+        MEM_UNLOCK(small_mem);
+    }
+#endif
+
+    if (ptr != NULL)
+        MEM_STAT_INC(small_mem, alloc_count);
+    else
+        MEM_STAT_INC(small_mem, failed_count);
+
+    return ptr;
+}
+
+/**
+ * @brief Allocate an aligned block of memory, the body of smem_memalign.
+ *
+ * @param small_mem the small memory management object.
+ *
+ * @param align is the alignment, a power of two.
+ *
+ * @param size is the minimum size of the requested block in bytes.
+ *
+ * @return the pointer to allocated memory or NULL if no free memory was found.
+ */
+static void *mem_memalign_entry(struct small_mem *small_mem, size_t align, size_t size)
+{
+    void *ptr;
+
+    if (size == 0 || align == 0 || (align & (align - 1)) != 0)
+        return NULL;
+
+    /* every block is aligned at SMEM_ALIGN_SIZE already */
+    if (align <= SMEM_ALIGN_SIZE)
+        return mem_alloc_entry(small_mem, size);
+
+    size = SMEM_ALIGN(size, SMEM_ALIGN_SIZE);
+    if (size < MIN_SIZE_ALIGNED)
+        size = MIN_SIZE_ALIGNED;
+
+    if (size > MEM_SIZE_MAX(small_mem) || align > MEM_SIZE_MAX(small_mem))
+    {
+        LOG_D("no memory\r\n");
+        MEM_STAT_INC(small_mem, failed_count);
+        return NULL;
+    }
+
+    MEM_LOCK(small_mem);
+    (void)remote_drain(small_mem);
+    ptr = mem_memalign(small_mem, align, size);
+    if (ptr == NULL && quick_drain(small_mem) != 0)
+        ptr = mem_memalign(small_mem, align, size);
+    MEM_SEQ(small_mem);
+    MEM_UNLOCK(small_mem);
+
+#if SMEM_USING_THREAD_SAFE && (SMEM_TCACHE_MAX_SIZE > 0)
+    if (ptr == NULL && tcache.heap == small_mem && tcache.total != 0)
+    {
+        /* the blocks held by this thread may be what is missing */
+        smem_tcache_flush();
+        MEM_LOCK(small_mem);
+        ptr = mem_memalign(small_mem, align, size);
+        MEM_SEQ(small_mem);
+        MEM_UNLOCK(small_mem);
+    }
+#endif
+
+    if (ptr != NULL)
+        MEM_STAT_INC(small_mem, alloc_count);
+    else
+        MEM_STAT_INC(small_mem, failed_count);
+
+    return ptr;
+}
+
+/**
+ * @brief Release a used block to the remote free queue, per-thread cache or heap,
+ *        the body of smem_free.
+ *
+ * @param small_mem the small memory management object of the block.
+ *
+ * @param mem is the item of the block.
+ */
+static void mem_free_entry(struct small_mem *small_mem, struct small_mem_item *mem)
+{
+    MEM_STAT_INC(small_mem, free_count);
+#if SMEM_USING_REMOTE_FREE
+    if (MEM_REMOTE(small_mem))
+    {
+        /* the lock stays with the owner, the next allocation under it releases the block */
+        MEM_SEQ(small_mem);
+        remote_push(small_mem, mem, mem);
+        return;
+    }
+#endif
+    /* a cached block stays with this thread, numbering it first is enough */
+    MEM_SEQ(small_mem);
+    if (tcache_push(small_mem, mem))
+        return;
+
+    MEM_LOCK(small_mem);
+    if (!quick_push(small_mem, mem))
+        mem_free(small_mem, mem);
+    MEM_SEQ(small_mem);
+    MEM_UNLOCK(small_mem);
+}
+
+/**
+ * @brief Change the size of a block, the body of smem_realloc.
+ *
+ * @param small_mem the small memory management object.
+ *
+ * @param rmem is the pointer to memory allocated by mem_alloc.
+ *
+ * @param newsize is the required new size.
+ *
+ * @return the changed memory block address.
+ */
+static void *mem_realloc_entry(struct small_mem *small_mem, void *rmem, size_t newsize)
+{
+    void *nptr;
+
+    /* alignment size */
+    newsize = SMEM_ALIGN(newsize, SMEM_ALIGN_SIZE);
+    if (newsize > MEM_SIZE_MAX(small_mem))
+    {
+        LOG_D("realloc: out of memory\r\n");
+        MEM_STAT_INC(small_mem, failed_count);
+        return NULL;
+    }
+    else if (newsize == 0)
+    {
+        if (rmem != NULL)
+            mem_free_entry(small_mem, (struct small_mem_item *)((uint8_t *)rmem - SIZEOF_STRUCT_MEM));
+        return NULL;
+    }
+
+    /* allocate a new memory block */
+    if (rmem == NULL)
+        return mem_alloc_entry(small_mem, newsize);
+
+    /* every data block must be at least MIN_SIZE_ALIGNED long to hold the free list links */
+    if (newsize < MIN_SIZE_ALIGNED)
+        newsize = MIN_SIZE_ALIGNED;
+
+    _ASSERT((((uintptr_t)rmem) & (SMEM_ALIGN_SIZE - 1)) == 0);
+    _ASSERT(mem_owns(small_mem, rmem));
+
+    MEM_LOCK(small_mem);
+    (void)remote_drain(small_mem);
+    nptr = mem_realloc(small_mem, (struct small_mem_item *)((uint8_t *)rmem - SIZEOF_STRUCT_MEM), newsize);
+    if (nptr == NULL && quick_drain(small_mem) != 0)
+        nptr = mem_realloc(small_mem, (struct small_mem_item *)((uint8_t *)rmem - SIZEOF_STRUCT_MEM), newsize);
+    MEM_SEQ(small_mem);
+    MEM_UNLOCK(small_mem);
+
+    MEM_STAT_INC(small_mem, realloc_count);
+    if (nptr == rmem)
+        MEM_STAT_INC(small_mem, realloc_inplace);
+    else if (nptr != NULL)
+        MEM_STAT_INC(small_mem, realloc_moved);
+    else
+        MEM_STAT_INC(small_mem, failed_count);
+
+    return nptr;
+}
+
+/**
+ * @brief Grow a block in place, the body of smem_try_expand.
+ *
+ * @param small_mem the small memory management object.
+ *
+ * @param rmem is the pointer to memory allocated by mem_alloc.
+ *
+ * @param newsize is the required new size.
+ *
+ * @return the usable size of the memory block after the call.
+ */
+static size_t mem_expand_entry(struct small_mem *small_mem, void *rmem, size_t newsize)
+{
+    struct small_mem_item *mem;
+    size_t size;
+
+    _ASSERT(rmem != NULL);
+    _ASSERT((((uintptr_t)rmem) & (SMEM_ALIGN_SIZE - 1)) == 0);
+    _ASSERT(mem_owns(small_mem, rmem));
+
+    mem = (struct small_mem_item *)((uint8_t *)rmem - SIZEOF_STRUCT_MEM);
+    _ASSERT(MEM_ISUSED(mem));
+
+    newsize = SMEM_ALIGN(newsize, SMEM_ALIGN_SIZE);
+
+    MEM_LOCK(small_mem);
+    if (newsize > MEM_SIZE(small_mem, mem))
+        mem_expand(small_mem, mem, newsize);
+    size = MEM_SIZE(small_mem, mem);
+    MEM_SEQ(small_mem);
+    MEM_UNLOCK(small_mem);
+
+    return size;
+}
+
+/**
+ * @brief Shrink a block in place, the body of smem_try_shrink.
+ *
+ * @param small_mem the small memory management object.
+ *
+ * @param rmem is the pointer to memory allocated by mem_alloc.
+ *
+ * @param newsize is the required new size.
+ *
+ * @return the usable size of the memory block after the call.
+ */
+static size_t mem_shrink_entry(struct small_mem *small_mem, void *rmem, size_t newsize)
+{
+    struct small_mem_item *mem;
+    size_t size;
+
+    _ASSERT(rmem != NULL);
+    _ASSERT((((uintptr_t)rmem) & (SMEM_ALIGN_SIZE - 1)) == 0);
+    _ASSERT(mem_owns(small_mem, rmem));
+
+    mem = (struct small_mem_item *)((uint8_t *)rmem - SIZEOF_STRUCT_MEM);
+    _ASSERT(MEM_ISUSED(mem));
+
+    newsize = SMEM_ALIGN(newsize, SMEM_ALIGN_SIZE);
+    if (newsize < MIN_SIZE_ALIGNED)
+        newsize = MIN_SIZE_ALIGNED;
+
+    MEM_LOCK(small_mem);
+    if (newsize < MEM_SIZE(small_mem, mem))
+        mem_split(small_mem, mem, newsize);
+    size = MEM_SIZE(small_mem, mem);
+    MEM_SEQ(small_mem);
+    MEM_UNLOCK(small_mem);
+
+    return size;
+}
+
+#if SMEM_USING_HOOK
+#define MEM_HOOKED(_heap) ((_heap)->hook_pre != NULL || (_heap)->hook_post != NULL)
+
+/**
+ * @brief Run an operation of a heap between its pre and post hooks.
+ *
+ * @param m the small memory management object.
+ *
+ * @param op is the operation.
+ *
+ * @param rmem is the block passed to realloc, free or the in place resizes.
+ *
+ * @param align is the alignment of an allocation, 0 for smem_alloc.
+ *
+ * @param size is the requested size.
+ *
+ * @return the block returned by the operation.
+ */
+static void *mem_hook_call(struct small_mem *m, enum smem_hook_op op, void *rmem, size_t align, size_t size)
+{
+    struct smem_hook_info info;
+    smem_hook_t hook;
+    uint64_t begin;
+
+    info.op = op;
+    info.ptr = NULL;
+    info.old_ptr = NULL;
+    info.size = size;
+    info.rounded = SMEM_ALIGN(size, SMEM_ALIGN_SIZE);
+    if (info.rounded != 0 && info.rounded < MIN_SIZE_ALIGNED)
+        info.rounded = MIN_SIZE_ALIGNED;
+    info.align = align;
+    info.cycles = 0;
+    info.seq = 0;
+    if (op == SMEM_HOOK_FREE)
+    {
+        info.ptr = rmem;
+        info.size = info.rounded = smem_usable_size(rmem);
+    }
+    else if (op != SMEM_HOOK_ALLOC)
+    {
+        info.old_ptr = rmem;
+    }
+
+    hook = m->hook_pre;
+    if (hook != NULL)
+        hook(m, &info, m->hook_tag);
+
+    /* an operation failing before it reaches the heap is numbered after the call */
+    mem_seq = MEM_SEQ_NONE;
+    begin = SMEM_HOOK_CYCLES();
+    switch (op)
+    {
+    case SMEM_HOOK_ALLOC:
+        info.ptr = align != 0 ? mem_memalign_entry(m, align, size) : mem_alloc_entry(m, size);
+        break;
+    case SMEM_HOOK_REALLOC:
+        info.ptr = mem_realloc_entry(m, rmem, size);
+        break;
+    case SMEM_HOOK_FREE:
+        mem_free_entry(m, (struct small_mem_item *)((uint8_t *)rmem - SIZEOF_STRUCT_MEM));
+        break;
+    case SMEM_HOOK_EXPAND:
+        (void)mem_expand_entry(m, rmem, size);
+        info.ptr = rmem;
+        break;
+    case SMEM_HOOK_SHRINK:
+        (void)mem_shrink_entry(m, rmem, size);
+        info.ptr = rmem;
+        break;
+    default:
+        break;
+    }
+    info.cycles = SMEM_HOOK_CYCLES() - begin;
+    info.seq = mem_seq != MEM_SEQ_NONE ? mem_seq : MEM_SEQ_NEXT(m);
+
+    if (op != SMEM_HOOK_FREE)
+        info.rounded = info.ptr != NULL ? smem_usable_size(info.ptr) : 0;
+
+    hook = m->hook_post;
+    if (hook != NULL)
+        hook(m, &info, m->hook_tag);
+
+    return info.ptr;
+}
+#endif
+
+/**
+ * @addtogroup group_memory_management
+ */
+
+/**@{*/
+
+/**
+ * @brief Allocate a block of memory with a minimum of 'size' bytes.
+ *
+ * @param m the small memory management object.
+ *
+ * @param size is the minimum size of the requested block in bytes.
+ *
+ * @return the pointer to allocated memory or NULL if no free memory was found.
+ */
+void *smem_alloc(smem_t m, size_t size)
+{
+    _ASSERT(m != NULL);
+
+#if SMEM_USING_HOOK
+    if (MEM_HOOKED(m))
+        return mem_hook_call(m, SMEM_HOOK_ALLOC, NULL, 0, size);
+#endif
+
+    return mem_alloc_entry(m, size);
+}
+
+/**
+ * @brief Allocate a block of memory with a minimum of 'size' bytes aligned at 'align'.
+ *        The block is released by smem_free, smem_realloc may move it to an
+ *        address aligned at SMEM_ALIGN_SIZE only.
+ *
+ * @param m the small memory management object.
+ *
+ * @param align is the alignment, a power of two.
+ *
+ * @param size is the minimum size of the requested block in bytes.
+ *
+ * @return the pointer to allocated memory or NULL if no free memory was found.
+ */
+void *smem_memalign(smem_t m, size_t align, size_t size)
+{
+    _ASSERT(m != NULL);
+
+#if SMEM_USING_HOOK
+    if (MEM_HOOKED(m))
+        return mem_hook_call(m, SMEM_HOOK_ALLOC, NULL, align, size);
+#endif
+
+    return mem_memalign_entry(m, align, size);
+}
+
+/**
+ * @brief Allocate a block of memory as C11 aligned_alloc does, size must be
+ *        a multiple of align.
+ *
+ * @param m the small memory management object.
+ *
+ * @param align is the alignment, a power of two.
+ *
+ * @param size is the size of the requested block in bytes.
+ *
+ * @return the pointer to allocated memory or NULL if no free memory was found.
+ */
+void *smem_aligned_alloc(smem_t m, size_t align, size_t size)
+{
+    if (align == 0 || size % align != 0)
+        return NULL;
+
+    return smem_memalign(m, align, size);
+}
+
+/**
+ * @brief Allocate up to n blocks of memory with a minimum of 'size' bytes each
+ *        under one lock, adjacent blocks are carved from one free block.
+ *
+ * @param m the small memory management object.
+ *
+ * @param size is the minimum size of every block in bytes.
+ *
+ * @param n is the number of blocks requested.
+ *
+ * @param out receives the pointers to the allocated blocks.
+ *
+ * @return the number of blocks allocated, less than n when the heap ran out of memory.
+ */
+size_t smem_alloc_batch(smem_t m, size_t size, size_t n, void **out)
+{
+    struct small_mem *small_mem;
+    size_t count;
+
+    if (size == 0 || n == 0)
+        return 0;
+
+    _ASSERT(m != NULL);
+    _ASSERT(out != NULL);
+
+#if SMEM_USING_HOOK
+    /* the hooks see every block, the batch is not carved under one lock then */
+    if (MEM_HOOKED(m))
+    {
+        for (count = 0; count < n; count++)
+        {
+            out[count] = mem_hook_call(m, SMEM_HOOK_ALLOC, NULL, 0, size);
+            if (out[count] == NULL)
+                break;
+        }
+        return count;
+    }
+#endif
+
+    small_mem = (struct small_mem *)m;
+    size = SMEM_ALIGN(size, SMEM_ALIGN_SIZE);
+    if (size < MIN_SIZE_ALIGNED)
+        size = MIN_SIZE_ALIGNED;
+
+    if (size > MEM_SIZE_MAX(small_mem))
+    {
+        LOG_D("no memory\r\n");
+        MEM_STAT_INC(small_mem, failed_count);
+        return 0;
+    }
+
+    MEM_LOCK(small_mem);
+    (void)remote_drain(small_mem);
+    count = mem_alloc_batch(small_mem, size, n, out);
+    if (count < n && quick_drain(small_mem) != 0)
+        count += mem_alloc_batch(small_mem, size, n - count, out + count);
+    MEM_UNLOCK(small_mem);
+
+#if SMEM_USING_THREAD_SAFE && (SMEM_TCACHE_MAX_SIZE > 0)
+    if (count < n && tcache.heap == small_mem && tcache.total != 0)
+    {
+        /* the blocks held by this thread may be what is missing */
+        smem_tcache_flush();
+        MEM_LOCK(small_mem);
+        count += mem_alloc_batch(small_mem, size, n - count, out + count);
+        MEM_UNLOCK(small_mem);
+    }
+#endif
+
+    MEM_STAT_ADD(small_mem, alloc_count, count);
+    if (count < n)
+        MEM_STAT_INC(small_mem, failed_count);
+
+    return count;
+}
+
+/**
+ * @brief This function will change the size of previously allocated memory block.
+ *
+ * @param m the small memory management object.
+ *
+ * @param rmem is the pointer to memory allocated by mem_alloc.
+ *
+ * @param newsize is the required new size.
+ *
+ * @return the changed memory block address.
+ */
+void *smem_realloc(smem_t m, void *rmem, size_t newsize)
+{
+    _ASSERT(m != NULL);
+
+#if SMEM_USING_HOOK
+    if (MEM_HOOKED(m))
+        return mem_hook_call(m, SMEM_HOOK_REALLOC, rmem, 0, newsize);
+#endif
+
+    return mem_realloc_entry(m, rmem, newsize);
+}
+
+/**
+ * @brief This function will try to grow a previously allocated memory block
+ *        without moving it.
+ *
+ * @param m the small memory management object.
+ *
+ * @param rmem is the pointer to memory allocated by mem_alloc.
+ *
+ * @param newsize is the required new size.
+ *
+ * @return the usable size of the memory block after the call. It is smaller than
+ *         newsize when the block can not be expanded, the block is left unchanged then.
+ */
+size_t smem_try_expand(smem_t m, void *rmem, size_t newsize)
+{
+    _ASSERT(m != NULL);
+
+#if SMEM_USING_HOOK
+    if (MEM_HOOKED(m))
+    {
+        mem_hook_call(m, SMEM_HOOK_EXPAND, rmem, 0, newsize);
+        return smem_usable_size(rmem);
+    }
+#endif
+
+    return mem_expand_entry(m, rmem, newsize);
+}
+
+/**
+ * @brief This function will shrink a previously allocated memory block in place
+ *        and give the tail back to the heap.
+ *
+ * @param m the small memory management object.
+ *
+ * @param rmem is the pointer to memory allocated by mem_alloc.
+ *
+ * @param newsize is the required new size.
+ *
+ * @return the usable size of the memory block after the call. It may stay larger
+ *         than newsize when the tail is too small to form a free block.
+ */
+size_t smem_try_shrink(smem_t m, void *rmem, size_t newsize)
+{
+    _ASSERT(m != NULL);
+
+#if SMEM_USING_HOOK
+    if (MEM_HOOKED(m))
+    {
+        mem_hook_call(m, SMEM_HOOK_SHRINK, rmem, 0, newsize);
+        return smem_usable_size(rmem);
+    }
+#endif
+
+    return mem_shrink_entry(m, rmem, newsize);
+}
+
+/**
+ * @brief This function will release the previously allocated memory block by
+ *        mem_alloc. The released memory block is taken back to system heap.
+ *
+ * @param rmem the address of memory which will be released.
+ */
+void smem_free(void *rmem)
+{
+    struct small_mem_item *mem;
+    struct small_mem *small_mem;
+
+    if (rmem == NULL)
+        return;
+
+    _ASSERT((((uintptr_t)rmem) & (SMEM_ALIGN_SIZE - 1)) == 0);
+
+    /* Get the corresponding struct small_mem_item ... */
+    mem = (struct small_mem_item *)((uint8_t *)rmem - SIZEOF_STRUCT_MEM);
+    /* ... which has to be in a used state ... */
+    small_mem = MEM_POOL(mem);
+    _ASSERT(small_mem != NULL);
+    _ASSERT(MEM_ISUSED(mem));
+    _ASSERT(mem_owns(small_mem, rmem));
+
+#if SMEM_USING_HOOK
+    if (MEM_HOOKED(small_mem))
+    {
+        mem_hook_call(small_mem, SMEM_HOOK_FREE, rmem, 0, 0);
+        return;
+    }
+#endif
+
+    mem_free_entry(small_mem, mem);
+}
+
+/**
+ * @brief This function will release n blocks at once. The array is sorted by
+ *        address so adjacent blocks are combined before they are released and
+ *        every heap is locked once per run of its blocks.
+ *
+ * @param ptrs the addresses of memory allocated by smem_alloc, NULL entries
+ *        are skipped. The array is reordered.
+ *
+ * @param n is the number of entries of ptrs.
+ */
+void smem_free_batch(void **ptrs, size_t n)
+{
+    struct small_mem_item *mem;
+    struct small_mem *small_mem;
+    size_t i, j;
+
+    if (ptrs == NULL || n == 0)
+        return;
 
-    if (mem < small_mem->lfree)
+    qsort(ptrs, n, sizeof(void *), mem_ptr_compare);
+
+    i = 0;
+    while (i < n && ptrs[i] == NULL)
+        i++;
+
+    while (i < n)
     {
-        /* the newly freed struct is now the lowest */
-        small_mem->lfree = mem;
+        mem = (struct small_mem_item *)((uint8_t *)ptrs[i] - SIZEOF_STRUCT_MEM);
+        small_mem = MEM_POOL(mem);
+        _ASSERT(small_mem != NULL);
+
+        /* the blocks of one heap follow each other once sorted */
+        for (j = i; j < n; j++)
+        {
+            _ASSERT((((uintptr_t)ptrs[j]) & (SMEM_ALIGN_SIZE - 1)) == 0);
+            mem = (struct small_mem_item *)((uint8_t *)ptrs[j] - SIZEOF_STRUCT_MEM);
+            if (MEM_POOL(mem) != small_mem)
+                break;
+            _ASSERT(MEM_ISUSED(mem));
+            _ASSERT(mem_owns(small_mem, ptrs[j]));
+        }
+
+#if SMEM_USING_HOOK
+        /* the hooks see every block */
+        if (MEM_HOOKED(small_mem))
+        {
+            for (; i < j; i++)
+                mem_hook_call(small_mem, SMEM_HOOK_FREE, ptrs[i], 0, 0);
+            continue;
+        }
+#endif
+
+#if SMEM_USING_REMOTE_FREE
+        if (MEM_REMOTE(small_mem))
+        {
+            struct small_mem_item *first = (struct small_mem_item *)((uint8_t *)ptrs[i] - SIZEOF_STRUCT_MEM);
+
+            /* the run is linked and queued with one push, the owner releases it like smem_free would */
+            MEM_STAT_ADD(small_mem, free_count, j - i);
+            for (mem = first, i++; i < j; i++)
+            {
+                MEM_LINK(mem)->next = (struct small_mem_item *)((uint8_t *)ptrs[i] - SIZEOF_STRUCT_MEM);
+                mem = MEM_LINK(mem)->next;
+            }
+            remote_push(small_mem, first, mem);
+            continue;
+        }
+#endif
+
+        MEM_LOCK(small_mem);
+        mem_free_batch(small_mem, &ptrs[i], j - i);
+        MEM_UNLOCK(small_mem);
+        MEM_STAT_ADD(small_mem, free_count, j - i);
+        i = j;
     }
+}
 
-    small_mem->parent.used -= (mem->next - ((uint8_t *)mem - small_mem->heap_ptr));
+/**
+ * @brief Allocate a block of memory with a minimum of 'size' bytes which
+ *        smem_compact may move. The block is reached through smem_hlock.
+ *
+ * @param m the small memory management object.
+ *
+ * @param size is the minimum size of the requested block in bytes.
+ *
+ * @return the handle of the block or NULL if no free memory was found.
+ */
+smem_handle_t smem_halloc(smem_t m, size_t size)
+{
+    struct small_mem_item *mem;
+    struct small_mem *small_mem;
+    struct smem_handle *handle;
+    void *ptr;
 
-    /* finally, see if prev or next are free also */
-    plug_holes(small_mem, mem);
+    _ASSERT(m != NULL);
+
+    if (size == 0 || size > ~(size_t)0 - HANDLE_HEAD)
+        return NULL;
+
+    small_mem = (struct small_mem *)m;
+    ptr = smem_alloc(m, HANDLE_HEAD + size);
+    if (ptr == NULL)
+        return NULL;
+
+    mem = (struct small_mem_item *)((uint8_t *)ptr - SIZEOF_STRUCT_MEM);
+    MEM_LOCK(small_mem);
+    handle = handle_get(small_mem);
+    if (handle != NULL)
+    {
+        handle->mem = mem;
+        handle->locks = 0;
+        HANDLE_OF(mem) = handle;
+        MEM_SET_MOVABLE(mem);
+    }
+    MEM_UNLOCK(small_mem);
+
+    if (handle == NULL)
+        smem_free(ptr);
+
+    return handle;
+}
+
+/**
+ * @brief This function will pin the block of a handle and return its address,
+ *        which stays valid until the matching smem_hunlock. Locks nest.
+ *
+ * @param h the handle returned by smem_halloc.
+ *
+ * @return the address of the block.
+ */
+void *smem_hlock(smem_handle_t h)
+{
+    void *ptr;
+
+    _ASSERT(h != NULL);
+
+    MEM_LOCK(h->heap);
+    h->locks++;
+    ptr = (uint8_t *)h->mem + SIZEOF_STRUCT_MEM + HANDLE_HEAD;
+    MEM_UNLOCK(h->heap);
+
+    return ptr;
+}
+
+/**
+ * @brief This function will release a lock taken by smem_hlock, the block may
+ *        move once every lock is released.
+ *
+ * @param h the handle returned by smem_halloc.
+ */
+void smem_hunlock(smem_handle_t h)
+{
+    _ASSERT(h != NULL);
+    _ASSERT(h->locks != 0);
+
+    MEM_LOCK(h->heap);
+    h->locks--;
+    MEM_UNLOCK(h->heap);
+}
+
+/**
+ * @brief This function will release the block of a handle and the handle.
+ *
+ * @param h the handle returned by smem_halloc, NULL is ignored.
+ */
+void smem_hfree(smem_handle_t h)
+{
+    struct small_mem_item *mem;
+    struct small_mem *small_mem;
+
+    if (h == NULL)
+        return;
+
+    small_mem = h->heap;
+    MEM_LOCK(small_mem);
+    mem = h->mem;
+    _ASSERT(MEM_ISMOVABLE(mem));
+    /* the block becomes a plain used block before it is released */
+    MEM_SET_USED(small_mem, mem);
+    h->mem = (struct small_mem_item *)small_mem->handle_free;
+    h->locks = 0;
+    small_mem->handle_free = h;
+    MEM_UNLOCK(small_mem);
+
+    smem_free((uint8_t *)mem + SIZEOF_STRUCT_MEM);
+}
+
+/**
+ * @brief This function will move unlocked handle blocks of the initial heap
+ *        down over the free space below them, so the free space gathers at the
+ *        top. Blocks of smem_alloc and locked blocks stay in place, added
+ *        regions are not compacted.
+ *
+ * @param m the small memory management object.
+ *
+ * @param budget is the maximum number of blocks visited by the call.
+ *
+ * @return the number of blocks moved.
+ */
+size_t smem_compact(smem_t m, size_t budget)
+{
+    struct small_mem *small_mem;
+    size_t moved;
+
+    _ASSERT(m != NULL);
+
+    small_mem = (struct small_mem *)m;
+    MEM_LOCK(small_mem);
+    moved = mem_compact(small_mem, budget);
+    MEM_UNLOCK(small_mem);
+
+    return moved;
+}
+
+#if SMEM_USING_REMOTE_FREE
+/**
+ * @brief This function will make the calling thread the owner of a heap. The
+ *        owner frees into the heap directly, other threads queue their frees
+ *        without taking the heap lock. A heap has no owner until then and
+ *        every thread frees into it directly. smem_shard_heap makes a thread
+ *        the owner of the heap it binds the thread to.
+ *
+ * @param m the small memory management object.
+ */
+void smem_set_owner(smem_t m)
+{
+    _ASSERT(m != NULL);
+
+    (void)SMEM_ATOMIC_XCHG_PTR(&m->owner, (const void *)&remote_self);
+}
+
+/**
+ * @brief This function will release the blocks queued by other threads than
+ *        the owner of a heap. Allocations do it on their own, queued blocks
+ *        count as used until then.
+ *
+ * @param m the small memory management object.
+ *
+ * @return the number of blocks released.
+ */
+size_t smem_remote_drain(smem_t m)
+{
+    struct small_mem *small_mem;
+    size_t count;
+
+    _ASSERT(m != NULL);
+
+    small_mem = (struct small_mem *)m;
+    MEM_LOCK(small_mem);
+    count = remote_drain(small_mem);
+    MEM_UNLOCK(small_mem);
+
+    return count;
+}
+#endif
+
+#if SMEM_USING_QUICK_LIST
+/**
+ * @brief This function will merge the freed blocks waiting on the quick lists
+ *        of a heap with their free neighbours. Waiting blocks count as used
+ *        for smem_walk, smem_get_stats, smem_compact and smem_trim until they
+ *        are merged.
+ *
+ * @param m the small memory management object.
+ *
+ * @return the number of blocks merged.
+ */
+size_t smem_coalesce(smem_t m)
+{
+    struct small_mem *small_mem;
+    size_t count;
+
+    _ASSERT(m != NULL);
+
+    small_mem = (struct small_mem *)m;
+    MEM_LOCK(small_mem);
+    count = quick_drain(small_mem);
+    MEM_UNLOCK(small_mem);
+
+    return count;
+}
+#endif
+
+/**
+ * @brief This function will return the memory object a block belongs to.
+ *
+ * @param rmem the address of memory allocated by mem_alloc.
+ *
+ * @return the memory object which owns the memory block.
+ */
+smem_t smem_owner(void *rmem)
+{
+    struct small_mem_item *mem;
+
+    _ASSERT(rmem != NULL);
+    _ASSERT((((uintptr_t)rmem) & (SMEM_ALIGN_SIZE - 1)) == 0);
+
+    mem = (struct small_mem_item *)((uint8_t *)rmem - SIZEOF_STRUCT_MEM);
+    _ASSERT(MEM_ISUSED(mem));
+
+    return (smem_t)MEM_POOL(mem);
+}
+
+/**
+ * @brief This function will return the usable size of a memory block, which
+ *        may be larger than the size it was allocated with.
+ *
+ * @param rmem the address of memory allocated by mem_alloc.
+ *
+ * @return the usable size of the memory block.
+ */
+size_t smem_usable_size(void *rmem)
+{
+    struct small_mem_item *mem;
+
+    _ASSERT(rmem != NULL);
+    _ASSERT((((uintptr_t)rmem) & (SMEM_ALIGN_SIZE - 1)) == 0);
+
+    mem = (struct small_mem_item *)((uint8_t *)rmem - SIZEOF_STRUCT_MEM);
+    _ASSERT(MEM_ISUSED(mem));
+
+    return MEM_SIZE(MEM_POOL(mem), mem);
+}
+
+#if SMEM_USING_STATS
+/*
+ * Add the blocks of the items [mem, end) to stats.
+ */
+static void mem_stats_walk(struct small_mem *m, struct small_mem_item *mem, struct small_mem_item *end,
+                           struct smem_stats *stats)
+{
+    size_t size;
+
+    for (; mem != end; mem = MEM_ITEM(m, mem->next))
+    {
+        if (MEM_ISUSED(mem))
+        {
+            stats->live_blocks++;
+            continue;
+        }
+
+        size = MEM_SIZE(m, mem);
+        stats->free_blocks++;
+        stats->free_size += size;
+        if (stats->largest_free < size)
+            stats->largest_free = size;
+    }
+}
+
+/**
+ * @brief This function will report the runtime statistics of a small memory
+ *        object. The blocks are counted by a walk of the heap under its lock,
+ *        blocks held by per-thread caches count as used.
+ *
+ * @param m the small memory management object.
+ *
+ * @param stats receives the statistics.
+ */
+void smem_get_stats(smem_t m, struct smem_stats *stats)
+{
+    struct small_mem *small_mem;
+    struct small_mem_region *region;
+
+    _ASSERT(m != NULL);
+    _ASSERT(stats != NULL);
+
+    small_mem = (struct small_mem *)m;
+    MEM_LOCK(small_mem);
+    stats->counters = small_mem->stats;
+    stats->total = small_mem->parent.total;
+    stats->used = small_mem->parent.used;
+    stats->max = small_mem->parent.max;
+    stats->live_blocks = 0;
+    stats->free_blocks = 0;
+    stats->free_size = 0;
+    stats->largest_free = 0;
+    mem_stats_walk(small_mem, (struct small_mem_item *)small_mem->heap_ptr, small_mem->heap_end, stats);
+    for (region = small_mem->regions; region != NULL; region = region->next)
+        mem_stats_walk(small_mem, MEM_REGION_FIRST(region), region->end, stats);
+    MEM_UNLOCK(small_mem);
+
+    stats->fragmentation = 0;
+    if (stats->free_size != 0)
+        stats->fragmentation = (uint32_t)((uint64_t)(stats->free_size - stats->largest_free) * 1000 / stats->free_size);
+}
+#endif
+
+/*
+ * Report the blocks of the items [mem, end) of an area to walk, returns
+ * non-zero when walk stopped the walk.
+ */
+static int mem_walk_area(struct small_mem *m, struct small_mem_item *mem, struct small_mem_item *end,
+                         uint32_t area, smem_walk_t walk, void *ctx, size_t *count)
+{
+    struct smem_block block;
+    uint8_t *base = (uint8_t *)mem;
+
+    block.area = area;
+    for (; mem != end; mem = MEM_ITEM(m, mem->next))
+    {
+        block.ptr = (uint8_t *)mem + SIZEOF_STRUCT_MEM;
+        block.offset = (size_t)((uint8_t *)mem - base);
+        block.size = MEM_SIZE(m, mem);
+        block.used = MEM_ISUSED(mem) ? 1 : 0;
+        (*count)++;
+        if (walk(&block, ctx) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief This function will report every block of a small memory object in
+ *        address order, the initial heap first and then the added regions.
+ *        The walk holds the lock of the heap, walk must not call into it.
+ *        Blocks held by per-thread caches are reported as used.
+ *
+ * @param m the small memory management object.
+ *
+ * @param walk is called for every block, it returns non-zero to stop the walk.
+ *
+ * @param ctx is passed to walk.
+ *
+ * @return the number of blocks reported.
+ */
+size_t smem_walk(smem_t m, smem_walk_t walk, void *ctx)
+{
+    struct small_mem *small_mem;
+    struct small_mem_region *region;
+    uint32_t area = 0;
+    size_t count = 0;
+
+    _ASSERT(m != NULL);
+    _ASSERT(walk != NULL);
+
+    small_mem = (struct small_mem *)m;
+    MEM_LOCK(small_mem);
+    if (!mem_walk_area(small_mem, (struct small_mem_item *)small_mem->heap_ptr, small_mem->heap_end, area, walk,
+                       ctx, &count))
+    {
+        for (region = small_mem->regions; region != NULL; region = region->next)
+        {
+            if (mem_walk_area(small_mem, MEM_REGION_FIRST(region), region->end, ++area, walk, ctx, &count))
+                break;
+        }
+    }
+    MEM_UNLOCK(small_mem);
+
+    return count;
+}
+
+struct mem_dump_context
+{
+    struct smem_dump_header *header;
+    struct smem_dump_record *record;
+    size_t capacity; /* number of records the buffer holds */
+};
+
+static int mem_dump_block(const struct smem_block *block, void *ctx)
+{
+    struct mem_dump_context *dump = (struct mem_dump_context *)ctx;
+    struct smem_dump_record *record;
+
+    if (block->offset == 0)
+        dump->header->areas++;
+    if (dump->header->count < dump->capacity)
+    {
+        record = &dump->record[dump->header->count];
+        record->offset = (uint32_t)(block->offset / SMEM_ALIGN_SIZE);
+        record->info = (uint32_t)(block->size / SMEM_ALIGN_SIZE) << 1 | (block->used ? SMEM_DUMP_USED : 0);
+    }
+    dump->header->count++;
+
+    return 0;
+}
+
+/**
+ * @brief This function will write the block map of a small memory object to
+ *        buf, a struct smem_dump_header followed by one struct smem_dump_record
+ *        per block in smem_walk order. Only the records which fit are written,
+ *        the call is repeated with a larger buffer when the return value
+ *        exceeds size. An area must be smaller than 16 GB.
+ *
+ * @param m the small memory management object.
+ *
+ * @param buf receives the map, aligned at 4 bytes.
+ *
+ * @param size is the size of buf in bytes, at least sizeof(struct smem_dump_header).
+ *
+ * @return the size of the whole map in bytes.
+ */
+size_t smem_dump(smem_t m, void *buf, size_t size)
+{
+    struct mem_dump_context dump;
+    size_t count;
+
+    _ASSERT(buf != NULL);
+    _ASSERT(size >= sizeof(struct smem_dump_header));
+    _ASSERT((((uintptr_t)buf) & (sizeof(uint32_t) - 1)) == 0);
+
+    dump.header = (struct smem_dump_header *)buf;
+    dump.record = (struct smem_dump_record *)(dump.header + 1);
+    dump.capacity = (size - sizeof(struct smem_dump_header)) / sizeof(struct smem_dump_record);
+    dump.header->magic = SMEM_DUMP_MAGIC;
+    dump.header->version = SMEM_DUMP_VERSION;
+    dump.header->align = SMEM_ALIGN_SIZE;
+    dump.header->count = 0;
+    dump.header->areas = 0;
+
+    count = smem_walk(m, mem_dump_block, &dump);
+    if (dump.header->count > dump.capacity)
+        dump.header->count = (uint32_t)dump.capacity;
+
+    return sizeof(struct smem_dump_header) + count * sizeof(struct smem_dump_record);
+}
+
+/**
+ * @brief This function will give the blocks cached by the calling thread back
+ *        to their heap. A thread should call it before it exits or before the
+ *        memory of the heap it used is released. It does nothing unless the
+ *        thread-safe mode is enabled.
+ */
+void smem_tcache_flush(void)
+{
+#if SMEM_USING_THREAD_SAFE && (SMEM_TCACHE_MAX_SIZE > 0)
+    struct small_mem_item *mem;
+    struct small_mem *small_mem;
+    size_t bin;
+
+    small_mem = tcache.heap;
+    if (small_mem != NULL && tcache.total != 0 && tcache.serial == small_mem->serial)
+    {
+        MEM_LOCK(small_mem);
+        for (bin = 0; bin < TCACHE_BIN_NUM; bin++)
+        {
+            while (tcache.bins[bin] != NULL)
+            {
+                mem = tcache.bins[bin];
+                tcache.bins[bin] = MEM_LINK(mem)->next;
+                mem_free(small_mem, mem);
+            }
+        }
+        MEM_UNLOCK(small_mem);
+    }
+    memset(&tcache, 0, sizeof(tcache));
+#endif
 }
 
 /**@}*/
 
+#if SMEM_PORT_MMAP
+/**
+ * @brief Page provider backed by anonymous mmap, the size is rounded up to
+ *        whole pages.
+ *
+ * @param size is the minimum size to map.
+ *
+ * @param actual receives the size mapped.
+ *
+ * @param arg is not used.
+ *
+ * @return the mapped address or NULL on failure.
+ */
+void *smem_port_page_alloc(size_t size, size_t *actual, void *arg)
+{
+    size_t page;
+    void *addr;
+
+    (void)arg;
+    page = (size_t)sysconf(_SC_PAGESIZE);
+    size = SMEM_ALIGN(size, page);
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    *actual = size;
+
+    return addr;
+}
+
+/**
+ * @brief This function will unmap a range mapped by smem_port_page_alloc.
+ *
+ * @param addr the mapped address.
+ *
+ * @param size is the mapped size.
+ *
+ * @param arg is not used.
+ */
+void smem_port_page_free(void *addr, size_t size, void *arg)
+{
+    (void)arg;
+    munmap(addr, size);
+}
+#endif
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2006-2024, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_TAG "[SMEM]"
+
+#include <string.h>
+#include "smem_arena.h"
+#include "smem_port.h"
+
+struct small_mem_arena_chunk
+{
+    struct small_mem_arena_chunk *prev; /**< older chunk */
+    uint8_t *end;                       /**< end of the payload */
+};
+
+#define CHUNK_HEAD_SIZE SMEM_ALIGN(sizeof(struct small_mem_arena_chunk), SMEM_ALIGN_SIZE)
+#define CHUNK_BEGIN(_chunk) ((uint8_t *)(_chunk) + CHUNK_HEAD_SIZE)
+
+static int chunk_grow(struct small_mem_arena *arena, size_t size)
+{
+    struct small_mem_arena_chunk *chunk;
+
+    /* an oversized request gets a chunk of its own */
+    if (size < arena->chunk_size)
+        size = arena->chunk_size;
+
+    chunk = (struct small_mem_arena_chunk *)smem_alloc(arena->heap, CHUNK_HEAD_SIZE + size);
+    if (chunk == NULL)
+    {
+        LOG_D("arena: no memory for a new chunk\r\n");
+        return 0;
+    }
+
+    chunk->prev = arena->chunk;
+    chunk->end = CHUNK_BEGIN(chunk) + size;
+    arena->chunk = chunk;
+    arena->ptr = CHUNK_BEGIN(chunk);
+    arena->end = chunk->end;
+
+    return 1;
+}
+
+/**
+ * @brief This function will create an arena in a heap.
+ *
+ * @param heap the small memory object the chunks are allocated from.
+ *
+ * @param chunk_size is the size taken from the heap at a time.
+ *
+ * @return the arena object or NULL if the heap is out of memory.
+ */
+smem_arena_t smem_arena_create(smem_t heap, size_t chunk_size)
+{
+    struct small_mem_arena *arena;
+
+    _ASSERT(heap != NULL);
+
+    if (chunk_size == 0 || chunk_size > SIZE_MAX - CHUNK_HEAD_SIZE - SMEM_ALIGN_SIZE)
+        return NULL;
+
+    arena = (struct small_mem_arena *)smem_alloc(heap, sizeof(*arena));
+    if (arena == NULL)
+        return NULL;
+
+    memset(arena, 0, sizeof(*arena));
+    arena->heap = heap;
+    arena->chunk_size = SMEM_ALIGN(chunk_size, SMEM_ALIGN_SIZE);
+
+    return arena;
+}
+
+/**
+ * @brief This function will give all chunks and the arena back to the heap.
+ *
+ * @param arena the arena object.
+ */
+void smem_arena_destroy(smem_arena_t arena)
+{
+    if (arena == NULL)
+        return;
+
+    smem_arena_reset(arena);
+    smem_free(arena);
+}
+
+/**
+ * @brief Allocate memory from an arena by bumping a pointer, the memory is
+ *        released by smem_arena_rollback or smem_arena_reset.
+ *
+ * @param arena the arena object.
+ *
+ * @param size is the minimum size of the requested block in bytes.
+ *
+ * @return the pointer to allocated memory or NULL if the heap is out of memory.
+ */
+void *smem_arena_alloc(smem_arena_t arena, size_t size)
+{
+    void *ptr;
+
+    _ASSERT(arena != NULL);
+
+    /* the rounded size and the chunk holding it must not wrap */
+    if (size == 0 || size > SIZE_MAX - CHUNK_HEAD_SIZE - SMEM_ALIGN_SIZE)
+        return NULL;
+
+    size = SMEM_ALIGN(size, SMEM_ALIGN_SIZE);
+    if ((size_t)(arena->end - arena->ptr) < size && !chunk_grow(arena, size))
+        return NULL;
+
+    ptr = arena->ptr;
+    arena->ptr += size;
+
+    return ptr;
+}
+
+/**
+ * @brief This function will take a checkpoint of an arena.
+ *
+ * @param arena the arena object.
+ *
+ * @return the checkpoint to pass to smem_arena_rollback.
+ */
+smem_arena_mark_t smem_arena_mark(smem_arena_t arena)
+{
+    smem_arena_mark_t mark;
+
+    _ASSERT(arena != NULL);
+
+    mark.chunk = arena->chunk;
+    mark.ptr = arena->ptr;
+
+    return mark;
+}
+
+/**
+ * @brief This function will release everything allocated after a checkpoint,
+ *        chunks taken after it go back to the heap.
+ *
+ * @param arena the arena object.
+ *
+ * @param mark the checkpoint taken by smem_arena_mark.
+ */
+void smem_arena_rollback(smem_arena_t arena, smem_arena_mark_t mark)
+{
+    struct small_mem_arena_chunk *chunk;
+
+    _ASSERT(arena != NULL);
+
+    while (arena->chunk != mark.chunk)
+    {
+        /* the checkpoint must not have been rolled back already */
+        _ASSERT(arena->chunk != NULL);
+        chunk = arena->chunk;
+        arena->chunk = chunk->prev;
+        smem_free(chunk);
+    }
+
+    if (mark.chunk != NULL)
+    {
+        _ASSERT(mark.ptr >= CHUNK_BEGIN(mark.chunk) && mark.ptr <= mark.chunk->end);
+        arena->ptr = mark.ptr;
+        arena->end = mark.chunk->end;
+    }
+    else
+    {
+        arena->ptr = arena->end = NULL;
+    }
+}
+
+/**
+ * @brief This function will release everything allocated from an arena and
+ *        give its chunks back to the heap.
+ *
+ * @param arena the arena object.
+ */
+void smem_arena_reset(smem_arena_t arena)
+{
+    smem_arena_mark_t empty = {NULL, NULL};
+
+    smem_arena_rollback(arena, empty);
+}
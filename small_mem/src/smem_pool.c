@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2006-2024, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_TAG "[SMEM]"
+
+#include <string.h>
+#include "smem_pool.h"
+#include "smem_port.h"
+
+/*
+ * A slab is a heap block aligned at slab_align holding a short header followed
+ * by objs_per_slab objects. It keeps its own free objects and the count of its
+ * objects in use, so a slab is given back once its last object is released.
+ */
+struct small_mem_slab
+{
+    struct small_mem_slab *next; /**< next slab of its list */
+    struct small_mem_slab *prev; /**< previous slab of its list */
+    void *free;                  /**< released objects of the slab, linked through their first word */
+    uint8_t *carve;              /**< next never used object */
+    size_t live;                 /**< objects in use */
+};
+
+#define SLAB_HEAD_SIZE SMEM_ALIGN(sizeof(struct small_mem_slab), SMEM_ALIGN_SIZE)
+#define SLAB_BEGIN(_slab) ((uint8_t *)(_slab) + SLAB_HEAD_SIZE)
+#define SLAB_END(_pool, _slab) (SLAB_BEGIN(_slab) + (_pool)->objs_per_slab * (_pool)->obj_size)
+#define SLAB_OF(_pool, _obj) ((struct small_mem_slab *)((uintptr_t)(_obj) & ~((_pool)->slab_align - 1)))
+#define SLAB_ISFULL(_pool, _slab) ((_slab)->free == NULL && (_slab)->carve == SLAB_END(_pool, _slab))
+
+#define OBJ_NEXT(_obj) (*(void **)(_obj))
+
+#if SMEM_USING_THREAD_SAFE
+#define POOL_LOCK(_pool) SMEM_LOCK_TAKE(&(_pool)->lock)
+#define POOL_UNLOCK(_pool) SMEM_LOCK_RELEASE(&(_pool)->lock)
+#else
+#define POOL_LOCK(_pool)
+#define POOL_UNLOCK(_pool)
+#endif
+
+static void slab_link(struct small_mem_slab **head, struct small_mem_slab *slab)
+{
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head != NULL)
+        (*head)->prev = slab;
+    *head = slab;
+}
+
+static void slab_unlink(struct small_mem_slab **head, struct small_mem_slab *slab)
+{
+    if (slab->prev != NULL)
+        slab->prev->next = slab->next;
+    else
+        *head = slab->next;
+    if (slab->next != NULL)
+        slab->next->prev = slab->prev;
+}
+
+static struct small_mem_slab *slab_grow(struct small_mem_pool *pool)
+{
+    struct small_mem_slab *slab;
+
+    slab = (struct small_mem_slab *)smem_memalign(pool->heap, pool->slab_align,
+                                                  SLAB_HEAD_SIZE + pool->objs_per_slab * pool->obj_size);
+    if (slab == NULL)
+    {
+        LOG_D("pool: no memory for a new slab\r\n");
+        return NULL;
+    }
+
+    slab->free = NULL;
+    slab->carve = SLAB_BEGIN(slab);
+    slab->live = 0;
+    slab_link(&pool->partial, slab);
+    pool->slab_count++;
+    pool->empty++;
+
+    return slab;
+}
+
+/**
+ * @brief This function will create a pool of fixed-size objects in a heap.
+ *
+ * @param heap the small memory object the slabs are allocated from.
+ *
+ * @param obj_size is the size of every object.
+ *
+ * @param objs_per_slab is the number of objects allocated from the heap at a time.
+ *
+ * @return the pool object or NULL if the heap is out of memory.
+ */
+smem_pool_t smem_pool_create(smem_t heap, size_t obj_size, size_t objs_per_slab)
+{
+    struct small_mem_pool *pool;
+    size_t slab_size, slab_align;
+
+    _ASSERT(heap != NULL);
+
+    if (obj_size == 0 || objs_per_slab == 0)
+        return NULL;
+
+    /* a free object must hold the link of its free list, the rounded size and the slab size must not wrap */
+    if (obj_size > SIZE_MAX - SMEM_ALIGN_SIZE)
+        return NULL;
+    obj_size = SMEM_ALIGN(obj_size < sizeof(void *) ? sizeof(void *) : obj_size, SMEM_ALIGN_SIZE);
+    if (objs_per_slab > (SIZE_MAX - SLAB_HEAD_SIZE) / obj_size)
+        return NULL;
+
+    /* the alignment of a slab is the power of two covering it */
+    slab_size = SLAB_HEAD_SIZE + objs_per_slab * obj_size;
+    if (slab_size > SIZE_MAX / 2 + 1)
+        return NULL;
+    for (slab_align = SMEM_ALIGN_SIZE; slab_align < slab_size; slab_align <<= 1)
+        ;
+
+    pool = (struct small_mem_pool *)smem_alloc(heap, sizeof(*pool));
+    if (pool == NULL)
+        return NULL;
+
+    memset(pool, 0, sizeof(*pool));
+    pool->heap = heap;
+    pool->obj_size = obj_size;
+    pool->objs_per_slab = objs_per_slab;
+    pool->slab_align = slab_align;
+#if SMEM_USING_THREAD_SAFE
+    SMEM_LOCK_INIT(&pool->lock);
+#endif
+
+    return pool;
+}
+
+/**
+ * @brief This function will give all slabs of a pool back to its heap, objects
+ *        still in use become invalid.
+ *
+ * @param pool the pool object.
+ */
+void smem_pool_destroy(smem_pool_t pool)
+{
+    struct small_mem_slab *slab;
+
+    if (pool == NULL)
+        return;
+
+    while ((slab = pool->partial) != NULL)
+    {
+        pool->partial = slab->next;
+        smem_free(slab);
+    }
+    while ((slab = pool->full) != NULL)
+    {
+        pool->full = slab->next;
+        smem_free(slab);
+    }
+    smem_free(pool);
+}
+
+/**
+ * @brief Allocate an object from a pool. A new slab is taken from the heap
+ *        when all slabs are in use.
+ *
+ * @param pool the pool object.
+ *
+ * @return the pointer to the object or NULL if the heap is out of memory.
+ */
+void *smem_pool_alloc(smem_pool_t pool)
+{
+    struct small_mem_slab *slab;
+    void *obj = NULL;
+
+    _ASSERT(pool != NULL);
+
+    POOL_LOCK(pool);
+    slab = pool->partial;
+    if (slab == NULL)
+        slab = slab_grow(pool);
+
+    if (slab != NULL)
+    {
+        obj = slab->free;
+        if (obj != NULL)
+        {
+            slab->free = OBJ_NEXT(obj);
+        }
+        else
+        {
+            obj = slab->carve;
+            slab->carve += pool->obj_size;
+        }
+
+        if (slab->live++ == 0)
+            pool->empty--;
+        if (SLAB_ISFULL(pool, slab))
+        {
+            slab_unlink(&pool->partial, slab);
+            slab_link(&pool->full, slab);
+        }
+        pool->used++;
+    }
+    POOL_UNLOCK(pool);
+
+    return obj;
+}
+
+/**
+ * @brief This function will release an object back to its pool. The slab of
+ *        the object goes back to the heap once none of its objects is in use,
+ *        SMEM_POOL_KEEP_EMPTY empty slabs are kept for the next allocations.
+ *
+ * @param pool the pool object.
+ *
+ * @param obj the object allocated by smem_pool_alloc.
+ */
+void smem_pool_free(smem_pool_t pool, void *obj)
+{
+    struct small_mem_slab *slab, *release = NULL;
+
+    _ASSERT(pool != NULL);
+
+    if (obj == NULL)
+        return;
+
+    _ASSERT((((uintptr_t)obj) & (SMEM_ALIGN_SIZE - 1)) == 0);
+
+    slab = SLAB_OF(pool, obj);
+
+    POOL_LOCK(pool);
+    _ASSERT((uint8_t *)obj >= SLAB_BEGIN(slab) && (uint8_t *)obj < slab->carve);
+    _ASSERT(slab->live != 0);
+    if (SLAB_ISFULL(pool, slab))
+    {
+        slab_unlink(&pool->full, slab);
+        slab_link(&pool->partial, slab);
+    }
+    OBJ_NEXT(obj) = slab->free;
+    slab->free = obj;
+    pool->used--;
+
+    if (--slab->live == 0)
+    {
+        if (pool->empty < SMEM_POOL_KEEP_EMPTY)
+        {
+            pool->empty++;
+        }
+        else
+        {
+            slab_unlink(&pool->partial, slab);
+            pool->slab_count--;
+            release = slab;
+        }
+    }
+    POOL_UNLOCK(pool);
+
+    if (release != NULL)
+        smem_free(release);
+}
+
+/**
+ * @brief This function will give the empty slabs a pool keeps back to the
+ *        heap, e.g. when the heap runs low.
+ *
+ * @param pool the pool object.
+ *
+ * @return the number of slabs released.
+ */
+size_t smem_pool_trim(smem_pool_t pool)
+{
+    struct small_mem_slab *slab, *next;
+    size_t released = 0;
+
+    _ASSERT(pool != NULL);
+
+    POOL_LOCK(pool);
+    for (slab = pool->partial; slab != NULL && pool->empty != 0; slab = next)
+    {
+        next = slab->next;
+        if (slab->live == 0)
+        {
+            slab_unlink(&pool->partial, slab);
+            pool->slab_count--;
+            pool->empty--;
+            smem_free(slab);
+            released++;
+        }
+    }
+    POOL_UNLOCK(pool);
+
+    return released;
+}
+
+/**
+ * @brief This function will report the occupancy of a pool.
+ *
+ * @param pool the pool object.
+ *
+ * @param info the occupancy of the pool.
+ */
+void smem_pool_info(smem_pool_t pool, struct smem_pool_info *info)
+{
+    _ASSERT(pool != NULL);
+    _ASSERT(info != NULL);
+
+    POOL_LOCK(pool);
+    info->obj_size = pool->obj_size;
+    info->slabs = pool->slab_count;
+    info->total = pool->slab_count * pool->objs_per_slab;
+    info->used = pool->used;
+    POOL_UNLOCK(pool);
+}
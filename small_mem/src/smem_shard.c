@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2006-2024, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#define LOG_TAG "[SMEM]"
+
+#include <string.h>
+#include "smem_shard.h"
+#include "smem_port.h"
+
+#ifndef SMEM_CPU_ID
+#if defined(__linux__)
+#include <sched.h>
+#define SMEM_CPU_ID() sched_getcpu()
+#else
+#define SMEM_CPU_ID() (-1)
+#endif
+#endif
+
+/* heap the calling thread was assigned to in round-robin mode */
+static SMEM_THREAD_LOCAL smem_shard_t shard_owner;
+static SMEM_THREAD_LOCAL uint32_t shard_index;
+
+/**
+ * @brief This function will split a memory region into several small memory
+ *        objects, so that threads allocating at the same time do not share a heap.
+ *
+ * @param begin_addr the beginning address of memory.
+ *
+ * @param size is the size of the memory.
+ *
+ * @param count is the number of heaps, at most SMEM_SHARD_MAX.
+ *
+ * @param mode selects how a thread is mapped to a heap.
+ *
+ * @return Return a pointer to the shard object. When the return value is NULL, it means the init failed.
+ */
+smem_shard_t smem_shard_init(void *begin_addr, size_t size, uint32_t count, enum smem_shard_mode mode)
+{
+    struct small_mem_shard *shard;
+    uintptr_t begin_align, end_align, heap_size;
+    uint32_t i;
+
+    if (count == 0 || count > SMEM_SHARD_MAX)
+    {
+        LOG_E("shard init, error heap count %u\r\n", (unsigned int)count);
+        return NULL;
+    }
+
+    shard = (struct small_mem_shard *)SMEM_ALIGN((uintptr_t)begin_addr, SMEM_ALIGN_SIZE);
+    begin_align = SMEM_ALIGN((uintptr_t)shard + sizeof(*shard), SMEM_ALIGN_SIZE);
+    end_align = SMEM_ALIGN_DOWN((uintptr_t)begin_addr + size, SMEM_ALIGN_SIZE);
+    if (end_align <= begin_align)
+    {
+        LOG_E("shard init, error begin address 0x%lx, and end address 0x%lx\r\n", (uintptr_t)begin_addr,
+              (uintptr_t)begin_addr + size);
+        return NULL;
+    }
+
+    memset(shard, 0, sizeof(*shard));
+    shard->count = count;
+    shard->mode = mode;
+
+    heap_size = SMEM_ALIGN_DOWN((end_align - begin_align) / count, SMEM_ALIGN_SIZE);
+    for (i = 0; i < count; i++)
+    {
+        shard->heaps[i] = smem_init((void *)(begin_align + i * heap_size), heap_size);
+        if (shard->heaps[i] == NULL)
+            return NULL;
+    }
+
+    return shard;
+}
+
+/**
+ * @brief This function will return the heap the calling thread allocates from.
+ *        The first call of a thread binds it to a heap in round robin mode
+ *        and makes it the owner of that heap, see smem_set_owner.
+ *
+ * @param s the shard object.
+ *
+ * @return the small memory object of the calling thread.
+ */
+smem_t smem_shard_heap(smem_shard_t s)
+{
+    int cpu;
+
+    _ASSERT(s != NULL);
+
+    if (s->mode == SMEM_SHARD_CPU)
+    {
+        cpu = SMEM_CPU_ID();
+        if (cpu >= 0)
+            return s->heaps[(uint32_t)cpu % s->count];
+    }
+
+    if (shard_owner != s)
+    {
+        shard_owner = s;
+        shard_index = SMEM_ATOMIC_FETCH_ADD(&s->next, 1) % s->count;
+#if SMEM_USING_REMOTE_FREE
+        /* the frees of the thread stay direct, the others queue theirs */
+        smem_set_owner(s->heaps[shard_index]);
+#endif
+    }
+
+    return s->heaps[shard_index];
+}
+
+/**
+ * @brief Allocate a block of memory from the heap of the calling thread, the
+ *        other heaps of the shard are tried when it is exhausted. The block is
+ *        released by smem_free.
+ *
+ * @param s the shard object.
+ *
+ * @param size is the minimum size of the requested block in bytes.
+ *
+ * @return the pointer to allocated memory or NULL if no free memory was found.
+ */
+void *smem_shard_alloc(smem_shard_t s, size_t size)
+{
+    smem_t heap;
+    void *ptr;
+    uint32_t i;
+
+    heap = smem_shard_heap(s);
+    ptr = smem_alloc(heap, size);
+    for (i = 0; ptr == NULL && size != 0 && i < s->count; i++)
+    {
+        if (s->heaps[i] != heap)
+            ptr = smem_alloc(s->heaps[i], size);
+    }
+
+    return ptr;
+}
+
+/**
+ * @brief This function will change the size of a memory block allocated from
+ *        a shard. The block is resized in the heap it belongs to and moved to
+ *        another heap of the shard when that one is exhausted.
+ *
+ * @param s the shard object.
+ *
+ * @param rmem is the pointer to memory allocated by smem_shard_alloc.
+ *
+ * @param newsize is the required new size.
+ *
+ * @return the changed memory block address.
+ */
+void *smem_shard_realloc(smem_shard_t s, void *rmem, size_t newsize)
+{
+    void *nptr;
+    size_t size;
+
+    if (rmem == NULL)
+        return smem_shard_alloc(s, newsize);
+
+    nptr = smem_realloc(smem_owner(rmem), rmem, newsize);
+    if (nptr != NULL || newsize == 0)
+        return nptr;
+
+    nptr = smem_shard_alloc(s, newsize);
+    if (nptr != NULL)
+    {
+        size = smem_usable_size(rmem);
+        memcpy(nptr, rmem, size < newsize ? size : newsize);
+        smem_free(rmem);
+    }
+
+    return nptr;
+}
@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2006-2024, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_TAG "[SMEM]"
+
+#include <stdlib.h>
+#include <string.h>
+#include "smem_trace.h"
+#include "smem_port.h"
+
+#if SMEM_USING_TRACE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if SMEM_USING_THREAD_SAFE
+#define TRACE_LOCK(_trace) SMEM_LOCK_TAKE(&(_trace)->lock)
+#define TRACE_UNLOCK(_trace) SMEM_LOCK_RELEASE(&(_trace)->lock)
+#else
+#define TRACE_LOCK(_trace)
+#define TRACE_UNLOCK(_trace)
+#endif
+
+#define TRACE_SATURATE(_val) ((_val) > UINT32_MAX ? UINT32_MAX : (uint32_t)(_val))
+
+/*
+ * Operation as the post hook reports it. Hooks of concurrent operations return
+ * in any order, so the events are sorted by their sequence number and turned
+ * into records in place once the recorder stops. A record is never larger
+ * than an event.
+ */
+struct smem_trace_event
+{
+    uint64_t seq;      /**< order of the operation in the heap */
+    uint64_t time;     /**< SMEM_HOOK_CYCLES when the hook ran */
+    uintptr_t ptr;     /**< block returned, released or moved to */
+    uintptr_t old_ptr; /**< block passed to realloc or moved from */
+    size_t size;       /**< requested size */
+    size_t rounded;    /**< usable size of ptr */
+    size_t align;      /**< alignment of smem_memalign */
+    uint32_t op;       /**< enum smem_hook_op */
+};
+
+/*
+ * Handles of the live blocks keyed by address, open addressing with linear
+ * probing. A table of twice the number of events never fills up.
+ */
+struct smem_trace_slot
+{
+    uintptr_t ptr;
+    uint32_t id;
+};
+
+struct smem_trace_map
+{
+    struct smem_trace_slot *slots;
+    size_t mask;
+    uint32_t next; /**< last handle given out */
+};
+
+#define TRACE_SLOT_EMPTY ((uintptr_t)0)
+#define TRACE_SLOT_GONE  ((uintptr_t)1) /* removed, blocks are never at odd addresses */
+
+static size_t trace_hash(struct smem_trace_map *map, uintptr_t ptr)
+{
+    uint64_t hash = (uint64_t)(ptr / SMEM_ALIGN_SIZE) * 0x9e3779b97f4a7c15ull;
+
+    return (size_t)(hash ^ (hash >> 32)) & map->mask;
+}
+
+/* slot of a live block, or NULL with *free set to the first slot it can take */
+static struct smem_trace_slot *trace_lookup(struct smem_trace_map *map, uintptr_t ptr, struct smem_trace_slot **free)
+{
+    struct smem_trace_slot *slot;
+    size_t i;
+
+    *free = NULL;
+    for (i = trace_hash(map, ptr);; i = (i + 1) & map->mask)
+    {
+        slot = &map->slots[i];
+        if (slot->ptr == ptr)
+            return slot;
+        if (slot->ptr == TRACE_SLOT_GONE && *free == NULL)
+            *free = slot;
+        if (slot->ptr == TRACE_SLOT_EMPTY)
+        {
+            if (*free == NULL)
+                *free = slot;
+            return NULL;
+        }
+    }
+}
+
+static void trace_put(struct smem_trace_map *map, uintptr_t ptr, uint32_t id)
+{
+    struct smem_trace_slot *slot, *free;
+
+    slot = trace_lookup(map, ptr, &free);
+    if (slot == NULL)
+        slot = free;
+    slot->ptr = ptr;
+    slot->id = id;
+}
+
+/*
+ * Handle of a live block, removed from the map when take is set. A block
+ * allocated before the trace started gets a handle no record created.
+ */
+static uint32_t trace_get(struct smem_trace_map *map, uintptr_t ptr, int take)
+{
+    struct smem_trace_slot *slot, *free;
+    uint32_t id;
+
+    slot = trace_lookup(map, ptr, &free);
+    if (slot == NULL)
+    {
+        id = ++map->next;
+        if (!take)
+            trace_put(map, ptr, id);
+        return id;
+    }
+
+    id = slot->id;
+    if (take)
+        slot->ptr = TRACE_SLOT_GONE;
+    return id;
+}
+
+static int trace_event_compare(const void *a, const void *b)
+{
+    uint64_t sa = ((const struct smem_trace_event *)a)->seq;
+    uint64_t sb = ((const struct smem_trace_event *)b)->seq;
+
+    return (sa > sb) - (sa < sb);
+}
+
+/* turn the sorted events into records in place, return the number of records */
+static size_t trace_convert(struct small_mem_trace *trace, size_t count, struct smem_trace_map *map)
+{
+    struct smem_trace_record *records = (struct smem_trace_record *)(trace->header + 1);
+    struct smem_trace_record *record;
+    struct smem_trace_event event;
+    uint32_t id, old_id, op;
+    uint64_t last = trace->start;
+    size_t i, n = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        /* the record may overwrite the event */
+        event = trace->events[i];
+        id = old_id = 0;
+        switch (event.op)
+        {
+        case SMEM_HOOK_ALLOC:
+            op = SMEM_TRACE_ALLOC;
+            if (event.ptr != 0)
+            {
+                id = ++map->next;
+                trace_put(map, event.ptr, id);
+            }
+            break;
+        case SMEM_HOOK_REALLOC:
+            op = SMEM_TRACE_REALLOC;
+            if (event.old_ptr == 0)
+            {
+                /* realloc of NULL allocates */
+                if (event.ptr != 0)
+                {
+                    id = ++map->next;
+                    trace_put(map, event.ptr, id);
+                }
+                break;
+            }
+            /* a moved block keeps its handle, a failed realloc keeps the old block */
+            old_id = trace_get(map, event.old_ptr, 1);
+            if (event.ptr != 0)
+            {
+                id = old_id;
+                trace_put(map, event.ptr, id);
+            }
+            else if (event.size != 0)
+            {
+                trace_put(map, event.old_ptr, old_id);
+            }
+            break;
+        case SMEM_HOOK_FREE:
+            op = SMEM_TRACE_FREE;
+            event.size = 0;
+            old_id = trace_get(map, event.ptr, 1);
+            break;
+        case SMEM_HOOK_EXPAND:
+        case SMEM_HOOK_SHRINK:
+            /* a block which could not grow is left as it was */
+            if (event.op == SMEM_HOOK_EXPAND && event.rounded < event.size)
+                continue;
+            op = event.op == SMEM_HOOK_EXPAND ? SMEM_TRACE_EXPAND : SMEM_TRACE_SHRINK;
+            id = old_id = trace_get(map, event.ptr, 0);
+            break;
+        case SMEM_HOOK_MOVE:
+            /* compaction is not an operation of the program */
+            trace_put(map, event.ptr, trace_get(map, event.old_ptr, 1));
+            continue;
+        default:
+            continue;
+        }
+
+        record = &records[n++];
+        record->delta = event.time > last ? TRACE_SATURATE(event.time - last) : 0;
+        record->size = TRACE_SATURATE(event.size);
+        record->id = id;
+        record->old_id = old_id;
+        record->align = old_id == 0 ? TRACE_SATURATE(event.align) : 0;
+        record->op = op;
+        if (event.time > last)
+            last = event.time;
+    }
+
+    return n;
+}
+
+static void trace_hook(struct small_mem *m, const struct smem_hook_info *info, void *tag)
+{
+    struct small_mem_trace *trace = (struct small_mem_trace *)tag;
+    struct smem_trace_event *event;
+
+    (void)m;
+    TRACE_LOCK(trace);
+    if (trace->header->count >= trace->capacity)
+    {
+        trace->header->dropped++;
+        TRACE_UNLOCK(trace);
+        return;
+    }
+
+    event = &trace->events[trace->header->count++];
+    event->seq = info->seq;
+    event->time = SMEM_HOOK_CYCLES();
+    event->ptr = (uintptr_t)info->ptr;
+    event->old_ptr = (uintptr_t)info->old_ptr;
+    event->size = info->size;
+    event->rounded = info->rounded;
+    event->align = info->align;
+    event->op = (uint32_t)info->op;
+    TRACE_UNLOCK(trace);
+}
+
+/**
+ * @brief This function will start to record the operations of a heap into a
+ *        file. The file is mapped for capacity operations and later ones are
+ *        only counted as dropped. The recorder replaces the hooks of the heap
+ *        until smem_trace_stop.
+ *
+ * @param trace the recorder object.
+ *
+ * @param heap the small memory object to trace.
+ *
+ * @param path is the trace file, it is created or truncated.
+ *
+ * @param capacity is the maximum number of operations.
+ *
+ * @return 0 on success, -1 when the file can not be created or mapped.
+ */
+int smem_trace_start(smem_trace_t trace, smem_t heap, const char *path, size_t capacity)
+{
+    size_t size;
+    void *map;
+    int fd;
+
+    _ASSERT(trace != NULL);
+    _ASSERT(heap != NULL);
+    _ASSERT(path != NULL);
+    _ASSERT(sizeof(struct smem_trace_record) <= sizeof(struct smem_trace_event));
+
+    if (capacity == 0 || capacity > (SIZE_MAX - sizeof(struct smem_trace_header)) / sizeof(struct smem_trace_event))
+        return -1;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        LOG_E("trace: can not open %s\r\n", path);
+        return -1;
+    }
+
+    size = sizeof(struct smem_trace_header) + capacity * sizeof(struct smem_trace_event);
+    map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0)
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        LOG_E("trace: can not map %s\r\n", path);
+        close(fd);
+        return -1;
+    }
+
+    memset(trace, 0, sizeof(*trace));
+    trace->heap = heap;
+    trace->fd = fd;
+    trace->header = (struct smem_trace_header *)map;
+    trace->events = (struct smem_trace_event *)(trace->header + 1);
+    trace->capacity = capacity;
+    /* the body holds events until smem_trace_stop turns them into records */
+    trace->header->magic = SMEM_TRACE_MAGIC_OPEN;
+    trace->header->version = SMEM_TRACE_VERSION;
+    trace->header->record_size = sizeof(struct smem_trace_record);
+#if SMEM_USING_THREAD_SAFE
+    SMEM_LOCK_INIT(&trace->lock);
+#endif
+    trace->start = SMEM_HOOK_CYCLES();
+    smem_set_hooks(heap, NULL, trace_hook, trace);
+
+    return 0;
+}
+
+/**
+ * @brief This function will stop a recorder and remove its hook. The
+ *        operations are put in the order the heap ran them, the blocks get
+ *        their handles and the trace file is cut to the records. The file
+ *        keeps SMEM_TRACE_MAGIC_OPEN until then, a process which exits
+ *        while recording leaves a file no reader takes for a trace.
+ *
+ * @param trace the recorder object.
+ *
+ * @return the number of records written.
+ */
+size_t smem_trace_stop(smem_trace_t trace)
+{
+    struct smem_trace_map map;
+    size_t count, size;
+
+    _ASSERT(trace != NULL);
+    _ASSERT(trace->header != NULL);
+
+    smem_set_hooks(trace->heap, NULL, NULL, NULL);
+
+    count = (size_t)trace->header->count;
+    qsort(trace->events, count, sizeof(struct smem_trace_event), trace_event_compare);
+
+    /* at least twice as many slots as puts, a power of two */
+    for (size = 2; size < count * 2; size *= 2)
+        ;
+    memset(&map, 0, sizeof(map));
+    map.mask = size - 1;
+    map.slots = (struct smem_trace_slot *)mmap(NULL, size * sizeof(struct smem_trace_slot), PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map.slots == MAP_FAILED)
+    {
+        LOG_E("trace: no memory for the block handles\r\n");
+        trace->header->dropped += (uint32_t)count;
+        count = 0;
+    }
+    else
+    {
+        count = trace_convert(trace, count, &map);
+        munmap(map.slots, size * sizeof(struct smem_trace_slot));
+    }
+    trace->header->count = count;
+    /* the file is complete once the header says so */
+    trace->header->magic = SMEM_TRACE_MAGIC;
+
+    munmap(trace->header, sizeof(struct smem_trace_header) + trace->capacity * sizeof(struct smem_trace_event));
+    if (ftruncate(trace->fd, (off_t)(sizeof(struct smem_trace_header) + count * sizeof(struct smem_trace_record))) != 0)
+    {
+        LOG_E("trace: can not truncate the trace file\r\n");
+    }
+    close(trace->fd);
+    trace->header = NULL;
+    trace->events = NULL;
+
+    return count;
+}
+#endif
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2006-2024, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef __SMEM_TEST_H
+#define __SMEM_TEST_H
+
+#include <stdlib.h>
+#include <gtest/gtest.h>
+#include <small_mem/inc/smem.h>
+
+/* blocks cached by this thread, queued by other threads or waiting to be merged are not visible in the heap */
+static inline void smem_test_settle(smem_t heap)
+{
+    smem_tcache_flush();
+#if SMEM_USING_REMOTE_FREE
+    smem_remote_drain(heap);
+#endif
+#if SMEM_USING_QUICK_LIST
+    smem_coalesce(heap);
+#endif
+    (void)heap;
+}
+
+static inline int smem_test_used_walk(const struct smem_block *block, void *ctx)
+{
+    if (block->used)
+        *(size_t *)ctx += block->size;
+    return 0;
+}
+
+/* usable bytes of the used blocks of a heap */
+static inline size_t smem_test_used(smem_t heap)
+{
+    size_t used = 0;
+
+    smem_test_settle(heap);
+    smem_walk(heap, smem_test_used_walk, &used);
+    return used;
+}
+
+/**
+ * Fixture owning a heap of HeapSize bytes on a malloc buffer
+ */
+template <size_t HeapSize>
+class SmallMemHeapTest : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        buf = malloc(HeapSize);
+        ASSERT_NE(buf, nullptr);
+        heap = smem_init(buf, HeapSize);
+        ASSERT_NE(heap, nullptr);
+    }
+
+    void TearDown() override
+    {
+        if (heap != nullptr)
+        {
+            smem_test_settle(heap);
+            smem_deinit(heap);
+        }
+        free(buf);
+    }
+
+    size_t heap_used(void)
+    {
+        return smem_test_used(heap);
+    }
+
+    bool in_heap(const void *ptr)
+    {
+        const uint8_t *addr = (const uint8_t *)ptr;
+
+        return addr >= (const uint8_t *)buf && addr < (const uint8_t *)buf + HeapSize;
+    }
+
+    void *buf = nullptr;
+    smem_t heap = nullptr;
+};
+
+#endif /* __SMEM_TEST_H */
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2006-2024, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include <gtest/gtest.h>
+#include <small_mem/inc/smem.h>
+#include <small_mem/inc/smem_arena.h>
+#include "smem_test.h"
+
+#define TEST_ARENA_HEAP_SIZE (16 * 1024)
+#define TEST_ARENA_CHUNK_SIZE 256
+
+class SmallMemArenaTest : public SmallMemHeapTest<TEST_ARENA_HEAP_SIZE>
+{
+};
+
+TEST_F(SmallMemArenaTest, arena_functional_test)
+{
+    smem_arena_mark_t mark;
+    smem_arena_t arena;
+    uint8_t *ptr, *prev;
+    size_t used;
+
+    EXPECT_EQ(smem_arena_create(heap, 0), nullptr);
+    arena = smem_arena_create(heap, TEST_ARENA_CHUNK_SIZE);
+    ASSERT_NE(arena, nullptr);
+    used = heap_used();
+    EXPECT_EQ(smem_arena_alloc(arena, 0), nullptr);
+    /* Sizes which wrap when rounded up are refused */
+    EXPECT_EQ(smem_arena_create(heap, SIZE_MAX), nullptr);
+    EXPECT_EQ(smem_arena_alloc(arena, SIZE_MAX), nullptr);
+    EXPECT_EQ(smem_arena_alloc(arena, SIZE_MAX - SMEM_ALIGN_SIZE), nullptr);
+
+    /* Consecutive allocations are adjacent and aligned */
+    prev = (uint8_t *)smem_arena_alloc(arena, 10);
+    ASSERT_NE(prev, nullptr);
+    ptr = (uint8_t *)smem_arena_alloc(arena, 10);
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_EQ(ptr, prev + SMEM_ALIGN(10, SMEM_ALIGN_SIZE));
+    EXPECT_EQ((uintptr_t)ptr % SMEM_ALIGN_SIZE, 0u);
+
+    /* Rolling back within a chunk hands the same memory out again */
+    mark = smem_arena_mark(arena);
+    prev = (uint8_t *)smem_arena_alloc(arena, 32);
+    smem_arena_rollback(arena, mark);
+    EXPECT_EQ(smem_arena_alloc(arena, 32), prev);
+
+    /* Chunks taken after a checkpoint go back to the heap on rollback */
+    mark = smem_arena_mark(arena);
+    size_t marked = heap_used();
+    for (int i = 0; i < 32; i++)
+    {
+        ptr = (uint8_t *)smem_arena_alloc(arena, 40);
+        ASSERT_NE(ptr, nullptr);
+        memset(ptr, i, 40);
+    }
+    EXPECT_GT(heap_used(), marked);
+    smem_arena_rollback(arena, mark);
+    EXPECT_EQ(heap_used(), marked);
+
+    /* An oversized request gets a chunk of its own */
+    ptr = (uint8_t *)smem_arena_alloc(arena, TEST_ARENA_CHUNK_SIZE * 4);
+    ASSERT_NE(ptr, nullptr);
+    memset(ptr, 0x5a, TEST_ARENA_CHUNK_SIZE * 4);
+
+    smem_arena_reset(arena);
+    EXPECT_EQ(heap_used(), used);
+    EXPECT_NE(smem_arena_alloc(arena, 10), nullptr);
+    smem_arena_destroy(arena);
+    EXPECT_EQ(heap_used(), 0u);
+}
+
+TEST_F(SmallMemArenaTest, arena_exhausted_test)
+{
+    smem_arena_t arena;
+    int count = 0;
+
+    arena = smem_arena_create(heap, TEST_ARENA_CHUNK_SIZE);
+    ASSERT_NE(arena, nullptr);
+    while (smem_arena_alloc(arena, 64) != nullptr)
+    {
+        count++;
+    }
+    EXPECT_GT(count, 0);
+    EXPECT_EQ(smem_arena_alloc(arena, TEST_ARENA_HEAP_SIZE), nullptr);
+    smem_arena_reset(arena);
+    EXPECT_NE(smem_arena_alloc(arena, 64), nullptr);
+    smem_arena_destroy(arena);
+    EXPECT_EQ(heap_used(), 0u);
+}
@@ -11,14 +11,14 @@
 #include <stdlib.h>
 #include <iostream>
 #include <chrono>
+#include <thread>
+#include <utility>
+#include <vector>
 #include <gtest/gtest.h>
 #include <small_mem/inc/smem.h>
 #include <small_mem/inc/smem_port.h>
 #include "list.h"
-
-#define MEM_SIZE(_heap, _mem)      \
-    (((struct small_mem_item *)(_mem))->next - ((unsigned long)(_mem) - \
-    (unsigned long)((_heap)->heap_ptr)) - SMEM_ALIGN(sizeof(struct small_mem_item), SMEM_ALIGN_SIZE))
+#include "smem_test.h"
 
 #define TEST_MEM_SIZE 1024
 
@@ -42,32 +42,40 @@ protected:
 
     int _mem_cmp(void *ptr, uint8_t v, size_t size)
     {
+        uint8_t *p = (uint8_t *)ptr;
+
         while (size-- != 0)
         {
-            if (*(uint8_t *)ptr != v)
-                return *(uint8_t *)ptr - v;
+            if (*p != v)
+                return *p - v;
+            p++;
         }
         return 0;
     }
 
+    static int max_block_walk(const struct smem_block *block, void *ctx)
+    {
+        size_t *max = (size_t *)ctx;
+
+        /* only the initial heap is measured */
+        if (block->area != 0)
+            return 1;
+        if (!block->used && block->size > *max)
+            *max = block->size;
+        return 0;
+    }
+
+    void settle(struct small_mem *heap)
+    {
+        smem_test_settle(heap);
+    }
+
     size_t max_block(struct small_mem *heap)
     {
-        struct small_mem_item *mem;
-        size_t max = 0, size;
+        size_t max = 0;
 
-        for (mem = (struct small_mem_item *)heap->heap_ptr;
-            mem != heap->heap_end;
-            mem = (struct small_mem_item *)&heap->heap_ptr[mem->next])
-        {
-            if (((unsigned long)mem->pool_ptr & 0x1) == 0)
-            {
-                size = MEM_SIZE(heap, mem);
-                if (size > max)
-                {
-                    max = size;
-                }
-            }
-        }
+        settle(heap);
+        smem_walk(heap, max_block_walk, &max);
         return max;
     }
 
@@ -562,3 +570,1289 @@ TEST_F(SmallMemTest, mem_realloc_test)
     /* release test resources */
     free(buf);
 }
+
+#define MEM_FREE_LIST_TEST_BLK 8
+
+TEST_F(SmallMemTest, mem_free_list_test)
+{
+    uint8_t *buf;
+    struct small_mem *heap;
+    size_t total_size, i;
+    void *ptr[MEM_FREE_LIST_TEST_BLK], *large, *reuse;
+
+    /* The layout below must not depend on the size of the memory object */
+    buf = (uint8_t *)malloc(TEST_MEM_SIZE + sizeof(struct small_mem));
+    EXPECT_NE(buf, nullptr);
+    memset(buf, 0xAA, TEST_MEM_SIZE + sizeof(struct small_mem));
+    heap = (struct small_mem *)smem_init(buf, TEST_MEM_SIZE + sizeof(struct small_mem));
+    total_size = max_block(heap);
+    EXPECT_NE(total_size, 0);
+    /* Split the heap into small blocks */
+    for (i = 0; i < MEM_FREE_LIST_TEST_BLK; i++)
+    {
+        ptr[i] = smem_alloc(heap, 32);
+        EXPECT_NE(ptr[i], nullptr);
+    }
+    /* Leave isolated small holes behind */
+    for (i = 0; i < MEM_FREE_LIST_TEST_BLK; i += 2)
+    {
+        smem_free(ptr[i]);
+    }
+    /* A large block must skip the small holes and come from the tail */
+    large = smem_alloc(heap, 128);
+    EXPECT_NE(large, nullptr);
+    EXPECT_GT((uintptr_t)large, (uintptr_t)ptr[MEM_FREE_LIST_TEST_BLK - 1]);
+    /* A small block must reuse one of the holes */
+    reuse = smem_alloc(heap, 32);
+    EXPECT_NE(reuse, nullptr);
+    EXPECT_LT((uintptr_t)reuse, (uintptr_t)ptr[MEM_FREE_LIST_TEST_BLK - 1]);
+    EXPECT_EQ(((uintptr_t)reuse - (uintptr_t)ptr[0]) % ((uintptr_t)ptr[2] - (uintptr_t)ptr[0]), 0);
+    /* Free everything and check whether the memory is fully merged */
+    smem_free(reuse);
+    smem_free(large);
+    for (i = 1; i < MEM_FREE_LIST_TEST_BLK; i += 2)
+    {
+        smem_free(ptr[i]);
+    }
+    EXPECT_EQ(max_block(heap), total_size);
+    EXPECT_NE(smem_alloc(heap, total_size), nullptr);
+    /* release test resources */
+    free(buf);
+}
+
+#define MEM_TLSF_TEST_COUNT 64
+#define MEM_TLSF_TEST_LOOP 100000
+
+TEST_F(SmallMemTest, mem_tlsf_test)
+{
+    uint8_t *buf;
+    struct small_mem *heap;
+    size_t total_size, i, idx;
+    struct mem_test_context ctx[MEM_TLSF_TEST_COUNT];
+
+    buf = (uint8_t *)malloc(TEST_MEM_SIZE * 8);
+    EXPECT_NE(buf, nullptr);
+    memset(buf, 0xAA, TEST_MEM_SIZE * 8);
+    heap = (struct small_mem *)smem_init_ex(buf, TEST_MEM_SIZE * 8, SMEM_POLICY_TLSF);
+    EXPECT_NE(heap, nullptr);
+    total_size = max_block(heap);
+    EXPECT_NE(total_size, 0);
+    /* The whole heap can be allocated at a time */
+    ctx[0].ptr = smem_alloc(heap, total_size);
+    EXPECT_NE(ctx[0].ptr, nullptr);
+    smem_free(ctx[0].ptr);
+    EXPECT_EQ(max_block(heap), total_size);
+    /* Random allocation and release */
+    memset(ctx, 0, sizeof(ctx));
+    for (i = 0; i < MEM_TLSF_TEST_LOOP; i++)
+    {
+        idx = rand() % MEM_TLSF_TEST_COUNT;
+        if (ctx[idx].ptr != nullptr)
+        {
+            EXPECT_EQ(_mem_cmp(ctx[idx].ptr, ctx[idx].magic, ctx[idx].size), 0);
+            smem_free(ctx[idx].ptr);
+            ctx[idx].ptr = nullptr;
+            continue;
+        }
+        ctx[idx].size = rand() % 256 + 1;
+        ctx[idx].magic = rand() & 0xff;
+        ctx[idx].ptr = smem_alloc(heap, ctx[idx].size);
+        if (ctx[idx].ptr != nullptr)
+        {
+            EXPECT_EQ(SMEM_ALIGN((uintptr_t)ctx[idx].ptr, SMEM_ALIGN_SIZE), (uintptr_t)ctx[idx].ptr);
+            memset(ctx[idx].ptr, ctx[idx].magic, ctx[idx].size);
+        }
+    }
+    for (idx = 0; idx < MEM_TLSF_TEST_COUNT; idx++)
+    {
+        if (ctx[idx].ptr != nullptr)
+        {
+            EXPECT_EQ(_mem_cmp(ctx[idx].ptr, ctx[idx].magic, ctx[idx].size), 0);
+            smem_free(ctx[idx].ptr);
+        }
+    }
+    /* Check whether the memory is fully merged */
+    EXPECT_EQ(max_block(heap), total_size);
+    /* release test resources */
+    free(buf);
+}
+
+TEST_F(SmallMemTest, mem_first_fit_test)
+{
+    uint8_t *buf;
+    struct small_mem *heap;
+    size_t total_size, i, idx, p;
+    struct mem_test_context ctx[MEM_TLSF_TEST_COUNT];
+    void *ptr[5], *big;
+    enum smem_policy policies[] = {SMEM_POLICY_FIRST_FIT, SMEM_POLICY_BITMAP};
+
+    buf = (uint8_t *)malloc(TEST_MEM_SIZE * 8);
+    EXPECT_NE(buf, nullptr);
+    for (p = 0; p < sizeof(policies) / sizeof(policies[0]); p++)
+    {
+        memset(buf, 0xAA, TEST_MEM_SIZE * 8);
+        heap = (struct small_mem *)smem_init_ex(buf, TEST_MEM_SIZE * 8, policies[p]);
+        EXPECT_NE(heap, nullptr);
+        total_size = max_block(heap);
+        EXPECT_NE(total_size, 0);
+        /* The lowest free block that fits is taken, whatever the release order */
+        for (i = 0; i < 5; i++)
+        {
+            ptr[i] = smem_alloc(heap, 64);
+            ASSERT_NE(ptr[i], nullptr);
+        }
+        smem_free(ptr[1]);
+        smem_free(ptr[3]);
+        settle(heap);
+        EXPECT_EQ(smem_alloc(heap, 64), ptr[1]);
+        EXPECT_EQ(smem_alloc(heap, 64), ptr[3]);
+        /* A block too small for the request is skipped */
+        smem_free(ptr[1]);
+        settle(heap);
+        big = smem_alloc(heap, 128);
+        EXPECT_GT((uintptr_t)big, (uintptr_t)ptr[4]);
+        EXPECT_EQ(smem_alloc(heap, 64), ptr[1]);
+        /* Neighbours freed in any order merge back into one block */
+        smem_free(ptr[3]);
+        smem_free(ptr[1]);
+        smem_free(big);
+        smem_free(ptr[2]);
+        smem_free(ptr[0]);
+        smem_free(ptr[4]);
+        EXPECT_EQ(max_block(heap), total_size);
+        /* Random allocation and release */
+        memset(ctx, 0, sizeof(ctx));
+        for (i = 0; i < MEM_TLSF_TEST_LOOP; i++)
+        {
+            idx = rand() % MEM_TLSF_TEST_COUNT;
+            if (ctx[idx].ptr != nullptr)
+            {
+                EXPECT_EQ(_mem_cmp(ctx[idx].ptr, ctx[idx].magic, ctx[idx].size), 0);
+                smem_free(ctx[idx].ptr);
+                ctx[idx].ptr = nullptr;
+                continue;
+            }
+            ctx[idx].size = rand() % 1024 + 1;
+            ctx[idx].magic = rand() & 0xff;
+            ctx[idx].ptr = smem_alloc(heap, ctx[idx].size);
+            if (ctx[idx].ptr != nullptr)
+                memset(ctx[idx].ptr, ctx[idx].magic, ctx[idx].size);
+        }
+        for (idx = 0; idx < MEM_TLSF_TEST_COUNT; idx++)
+        {
+            if (ctx[idx].ptr != nullptr)
+            {
+                EXPECT_EQ(_mem_cmp(ctx[idx].ptr, ctx[idx].magic, ctx[idx].size), 0);
+                smem_free(ctx[idx].ptr);
+            }
+        }
+        /* Check whether the memory is fully merged */
+        EXPECT_EQ(max_block(heap), total_size);
+        ptr[0] = smem_alloc(heap, total_size);
+        EXPECT_NE(ptr[0], nullptr);
+        smem_free(ptr[0]);
+    }
+    /* release test resources */
+    free(buf);
+}
+
+TEST_F(SmallMemTest, mem_fit_policy_test)
+{
+    uint8_t *buf;
+    struct small_mem *heap;
+    size_t total_size, i, idx, p;
+    struct mem_test_context ctx[MEM_TLSF_TEST_COUNT];
+    void *ptr[5], *fit;
+    enum smem_policy policies[] = {SMEM_POLICY_FIRST_FIT, SMEM_POLICY_NEXT_FIT, SMEM_POLICY_BEST_FIT,
+                                   SMEM_POLICY_GOOD_FIT};
+    size_t sizes[] = {64, 256, 64, 96, 64};
+
+    buf = (uint8_t *)malloc(TEST_MEM_SIZE * 8);
+    EXPECT_NE(buf, nullptr);
+    for (p = 0; p < sizeof(policies) / sizeof(policies[0]); p++)
+    {
+        memset(buf, 0xAA, TEST_MEM_SIZE * 8);
+        heap = (struct small_mem *)smem_init_ex(buf, TEST_MEM_SIZE * 8, policies[p]);
+        EXPECT_NE(heap, nullptr);
+        total_size = max_block(heap);
+        for (i = 0; i < 5; i++)
+        {
+            ptr[i] = smem_alloc(heap, sizes[i]);
+            ASSERT_NE(ptr[i], nullptr);
+        }
+        /* Holes of 256 and 96 bytes, the policies disagree on where 80 bytes go */
+        smem_free(ptr[1]);
+        smem_free(ptr[3]);
+        settle(heap);
+        fit = smem_alloc(heap, 80);
+        ASSERT_NE(fit, nullptr);
+        if (policies[p] == SMEM_POLICY_FIRST_FIT)
+            EXPECT_EQ(fit, ptr[1]);
+        else if (policies[p] == SMEM_POLICY_NEXT_FIT)
+            EXPECT_GT((uintptr_t)fit, (uintptr_t)ptr[4]);
+        else
+            EXPECT_EQ(fit, ptr[3]);
+        smem_free(fit);
+        for (i = 0; i < 5; i++)
+        {
+            if (i != 1 && i != 3)
+                smem_free(ptr[i]);
+        }
+        EXPECT_EQ(max_block(heap), total_size);
+        /* Random allocation and release */
+        memset(ctx, 0, sizeof(ctx));
+        for (i = 0; i < MEM_TLSF_TEST_LOOP; i++)
+        {
+            idx = rand() % MEM_TLSF_TEST_COUNT;
+            if (ctx[idx].ptr != nullptr)
+            {
+                EXPECT_EQ(_mem_cmp(ctx[idx].ptr, ctx[idx].magic, ctx[idx].size), 0);
+                smem_free(ctx[idx].ptr);
+                ctx[idx].ptr = nullptr;
+                continue;
+            }
+            ctx[idx].size = rand() % 512 + 1;
+            ctx[idx].magic = rand() & 0xff;
+            ctx[idx].ptr = smem_alloc(heap, ctx[idx].size);
+            if (ctx[idx].ptr != nullptr)
+                memset(ctx[idx].ptr, ctx[idx].magic, ctx[idx].size);
+        }
+        for (idx = 0; idx < MEM_TLSF_TEST_COUNT; idx++)
+        {
+            if (ctx[idx].ptr != nullptr)
+            {
+                EXPECT_EQ(_mem_cmp(ctx[idx].ptr, ctx[idx].magic, ctx[idx].size), 0);
+                smem_free(ctx[idx].ptr);
+            }
+        }
+        /* Check whether the memory is fully merged */
+        EXPECT_EQ(max_block(heap), total_size);
+    }
+    /* release test resources */
+    free(buf);
+}
+
+TEST_F(SmallMemTest, mem_realloc_inplace_test)
+{
+    uint8_t *buf;
+    struct small_mem *heap;
+    size_t total_size;
+    struct mem_test_context ctx[3];
+    void *ptr;
+
+    buf = (uint8_t *)malloc(TEST_MEM_SIZE);
+    EXPECT_NE(buf, nullptr);
+    memset(buf, 0xAA, TEST_MEM_SIZE);
+    heap = (struct small_mem *)smem_init(buf, TEST_MEM_SIZE);
+    total_size = max_block(heap);
+    /* Grow into the free next block, the address does not change */
+    {
+        ctx[0].magic = 0x5A;
+        ctx[0].size = 64;
+        ctx[0].ptr = smem_alloc(heap, ctx[0].size);
+        EXPECT_NE(ctx[0].ptr, nullptr);
+        memset(ctx[0].ptr, ctx[0].magic, ctx[0].size);
+        ptr = smem_realloc(heap, ctx[0].ptr, 256);
+        EXPECT_EQ(ptr, ctx[0].ptr);
+        EXPECT_EQ(_mem_cmp(ptr, ctx[0].magic, ctx[0].size), 0);
+        smem_free(ptr);
+        EXPECT_EQ(max_block(heap), total_size);
+    }
+    /* Grow into the free previous block, the data is moved down */
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            ctx[i].magic = 0x10 + i;
+            ctx[i].size = 64;
+            ctx[i].ptr = smem_alloc(heap, ctx[i].size);
+            EXPECT_NE(ctx[i].ptr, nullptr);
+            memset(ctx[i].ptr, ctx[i].magic, ctx[i].size);
+        }
+        smem_free(ctx[0].ptr);
+        settle(heap);
+        ptr = smem_realloc(heap, ctx[1].ptr, 128);
+        EXPECT_EQ(ptr, ctx[0].ptr);
+        EXPECT_EQ(_mem_cmp(ptr, ctx[1].magic, ctx[1].size), 0);
+        EXPECT_EQ(_mem_cmp(ctx[2].ptr, ctx[2].magic, ctx[2].size), 0);
+        smem_free(ptr);
+        smem_free(ctx[2].ptr);
+        EXPECT_EQ(max_block(heap), total_size);
+        EXPECT_EQ(heap->parent.used, 0);
+    }
+    /* release test resources */
+    free(buf);
+}
+
+TEST_F(SmallMemTest, mem_try_resize_test)
+{
+    uint8_t *buf;
+    struct small_mem *heap;
+    size_t total_size, size;
+    void *ptr, *next;
+
+    buf = (uint8_t *)malloc(TEST_MEM_SIZE);
+    EXPECT_NE(buf, nullptr);
+    memset(buf, 0xAA, TEST_MEM_SIZE);
+    heap = (struct small_mem *)smem_init(buf, TEST_MEM_SIZE);
+    total_size = max_block(heap);
+    ptr = smem_alloc(heap, 64);
+    EXPECT_NE(ptr, nullptr);
+    memset(ptr, 0x5A, 64);
+    /* Grow into the free tail */
+    size = smem_try_expand(heap, ptr, 256);
+    EXPECT_GE(size, 256);
+    EXPECT_EQ(_mem_cmp(ptr, 0x5A, 64), 0);
+    /* Shrink back and give the tail to the heap */
+    size = smem_try_shrink(heap, ptr, 64);
+    EXPECT_GE(size, 64);
+    EXPECT_LT(size, 256);
+    /* A used neighbour blocks any expansion */
+    next = smem_alloc(heap, 32);
+    EXPECT_NE(next, nullptr);
+    EXPECT_EQ(smem_try_expand(heap, ptr, size + SMEM_ALIGN_SIZE), size);
+    smem_free(next);
+    /* Requests larger than the heap leave the block unchanged */
+    EXPECT_EQ(smem_try_expand(heap, ptr, total_size * 2), size);
+    EXPECT_EQ(_mem_cmp(ptr, 0x5A, 64), 0);
+    smem_free(ptr);
+    EXPECT_EQ(max_block(heap), total_size);
+    /* release test resources */
+    free(buf);
+}
+
+TEST_F(SmallMemTest, mem_memalign_test)
+{
+    uint8_t *buf;
+    struct small_mem *heap;
+    size_t total_size;
+    void *ptr[4], *nptr;
+    size_t aligns[] = {16, 32, 64, 128, 256};
+
+    buf = (uint8_t *)malloc(TEST_MEM_SIZE * 8);
+    EXPECT_NE(buf, nullptr);
+    heap = (struct small_mem *)smem_init(buf, TEST_MEM_SIZE * 8);
+    total_size = max_block(heap);
+    /* Invalid alignments are refused */
+    EXPECT_EQ(smem_memalign(heap, 0, 32), nullptr);
+    EXPECT_EQ(smem_memalign(heap, 48, 32), nullptr);
+    EXPECT_EQ(smem_aligned_alloc(heap, 64, 100), nullptr);
+    for (size_t align : aligns)
+    {
+        /* A small block in front shifts the free space off any alignment */
+        ptr[0] = smem_alloc(heap, 8);
+        EXPECT_NE(ptr[0], nullptr);
+        for (int i = 1; i < 4; i++)
+        {
+            ptr[i] = smem_memalign(heap, align, 40 * i);
+            ASSERT_NE(ptr[i], nullptr);
+            EXPECT_EQ((uintptr_t)ptr[i] % align, 0u);
+            EXPECT_GE(smem_usable_size(ptr[i]), 40u * i);
+            memset(ptr[i], 0x5A, 40 * i);
+        }
+        /* The leading slack is a real free block that coalesces again */
+        smem_free(ptr[0]);
+        smem_free(ptr[2]);
+        nptr = smem_realloc(heap, ptr[1], 200);
+        ASSERT_NE(nptr, nullptr);
+        EXPECT_EQ(_mem_cmp(nptr, 0x5A, 40), 0);
+        smem_free(nptr);
+        smem_free(ptr[3]);
+        EXPECT_EQ(max_block(heap), total_size);
+    }
+    ptr[0] = smem_aligned_alloc(heap, 64, 128);
+    EXPECT_NE(ptr[0], nullptr);
+    EXPECT_EQ((uintptr_t)ptr[0] % 64, 0u);
+    smem_free(ptr[0]);
+    EXPECT_EQ(max_block(heap), total_size);
+    /* release test resources */
+    free(buf);
+}
+
+TEST_F(SmallMemTest, mem_batch_test)
+{
+    uint8_t *buf;
+    struct small_mem *heap;
+    size_t total_size, count;
+    void *ptrs[64];
+
+    buf = (uint8_t *)malloc(TEST_MEM_SIZE * 8);
+    EXPECT_NE(buf, nullptr);
+    heap = (struct small_mem *)smem_init(buf, TEST_MEM_SIZE * 8);
+    total_size = max_block(heap);
+    EXPECT_EQ(smem_alloc_batch(heap, 0, 8, ptrs), 0u);
+    EXPECT_EQ(smem_alloc_batch(heap, 32, 0, ptrs), 0u);
+    /* Blocks of one burst are carved next to each other */
+    count = smem_alloc_batch(heap, 32, 16, ptrs);
+    EXPECT_EQ(count, 16u);
+    for (size_t i = 0; i < count; i++)
+    {
+        EXPECT_GE(smem_usable_size(ptrs[i]), 32u);
+        memset(ptrs[i], (int)i, 32);
+        if (i > 0)
+        {
+            EXPECT_GT((uintptr_t)ptrs[i], (uintptr_t)ptrs[i - 1]);
+        }
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        EXPECT_EQ(_mem_cmp(ptrs[i], (uint8_t)i, 32), 0);
+    }
+    /* Order and NULL entries do not matter when freeing */
+    std::swap(ptrs[0], ptrs[9]);
+    ptrs[count] = NULL;
+    smem_free_batch(ptrs, count + 1);
+    EXPECT_EQ(max_block(heap), total_size);
+    /* A burst larger than the heap returns what fits */
+    count = smem_alloc_batch(heap, 128, 64, ptrs);
+    EXPECT_GT(count, 0u);
+    EXPECT_LT(count, 64u);
+    EXPECT_EQ(smem_alloc(heap, 128), nullptr);
+    /* Freeing every other block leaves holes which coalesce later */
+    for (size_t i = 0; i < count; i += 2)
+    {
+        smem_free(ptrs[i]);
+        ptrs[i] = NULL;
+    }
+    smem_free_batch(ptrs, count);
+    EXPECT_EQ(max_block(heap), total_size);
+    /* release test resources */
+    free(buf);
+}
+
+TEST_F(SmallMemTest, mem_region_test)
+{
+    uint8_t *mem, *buf, *bank[2];
+    struct small_mem *heap;
+    size_t total_size;
+    void *ptr[3];
+    enum smem_policy policies[] = {SMEM_POLICY_SEGREGATED, SMEM_POLICY_TLSF, SMEM_POLICY_BITMAP,
+                                   SMEM_POLICY_FIRST_FIT, SMEM_POLICY_NEXT_FIT, SMEM_POLICY_GOOD_FIT};
+
+    /* One bank below the heap and one above it, with gaps in between */
+    mem = (uint8_t *)malloc(TEST_MEM_SIZE * 9);
+    ASSERT_NE(mem, nullptr);
+    bank[0] = mem;
+    buf = mem + TEST_MEM_SIZE * 5;
+    bank[1] = mem + TEST_MEM_SIZE * 7;
+    for (enum smem_policy policy : policies)
+    {
+        heap = (struct small_mem *)smem_init_ex(buf, TEST_MEM_SIZE, policy);
+        ASSERT_NE(heap, nullptr);
+        total_size = heap->parent.total;
+        /* Regions must be large enough and must not overlap the heap */
+        EXPECT_EQ(smem_add_region(heap, bank[0], 16), -1);
+        EXPECT_EQ(smem_add_region(heap, buf + TEST_MEM_SIZE / 2, TEST_MEM_SIZE), -1);
+        EXPECT_EQ(smem_add_region(heap, bank[0], TEST_MEM_SIZE * 4), 0);
+        EXPECT_EQ(smem_add_region(heap, bank[0] + TEST_MEM_SIZE, TEST_MEM_SIZE), -1);
+        EXPECT_EQ(smem_add_region(heap, bank[1], TEST_MEM_SIZE * 2), 0);
+        EXPECT_GT(heap->parent.total, total_size + TEST_MEM_SIZE * 5);
+        /* A block larger than the initial heap comes from the largest region */
+        ptr[0] = smem_alloc(heap, TEST_MEM_SIZE * 3);
+        ASSERT_NE(ptr[0], nullptr);
+        EXPECT_TRUE((uint8_t *)ptr[0] > bank[0] && (uint8_t *)ptr[0] < bank[0] + TEST_MEM_SIZE * 4);
+        ptr[1] = smem_alloc(heap, TEST_MEM_SIZE + TEST_MEM_SIZE / 2);
+        ASSERT_NE(ptr[1], nullptr);
+        EXPECT_TRUE((uint8_t *)ptr[1] > bank[1] && (uint8_t *)ptr[1] < bank[1] + TEST_MEM_SIZE * 2);
+        ptr[2] = smem_alloc(heap, TEST_MEM_SIZE / 2);
+        ASSERT_NE(ptr[2], nullptr);
+        memset(ptr[0], 0x11, TEST_MEM_SIZE * 3);
+        memset(ptr[1], 0x22, TEST_MEM_SIZE + TEST_MEM_SIZE / 2);
+        memset(ptr[2], 0x33, TEST_MEM_SIZE / 2);
+        EXPECT_EQ(smem_owner(ptr[0]), heap);
+        EXPECT_EQ(smem_owner(ptr[1]), heap);
+        /* Blocks move between regions on realloc */
+        smem_free(ptr[1]);
+        ptr[1] = smem_realloc(heap, ptr[2], TEST_MEM_SIZE + TEST_MEM_SIZE / 2);
+        ASSERT_NE(ptr[1], nullptr);
+        EXPECT_TRUE((uint8_t *)ptr[1] > bank[1] && (uint8_t *)ptr[1] < bank[1] + TEST_MEM_SIZE * 2);
+        EXPECT_EQ(_mem_cmp(ptr[1], 0x33, TEST_MEM_SIZE / 2), 0);
+        ptr[2] = smem_realloc(heap, ptr[0], TEST_MEM_SIZE * 3 + 64);
+        ASSERT_NE(ptr[2], nullptr);
+        EXPECT_EQ(_mem_cmp(ptr[2], 0x11, TEST_MEM_SIZE * 3), 0);
+        smem_free(ptr[1]);
+        smem_free(ptr[2]);
+        smem_tcache_flush();
+        EXPECT_EQ(heap->parent.used, 0u);
+        /* Every region is whole again */
+        ptr[0] = smem_alloc(heap, heap->region_max);
+        EXPECT_NE(ptr[0], nullptr);
+        smem_free(ptr[0]);
+    }
+    /* release test resources */
+    free(mem);
+}
+
+static int mem_walk_collect(const struct smem_block *block, void *ctx)
+{
+    std::vector<struct smem_block> *blocks = (std::vector<struct smem_block> *)ctx;
+
+    blocks->push_back(*block);
+    return 0;
+}
+
+static int mem_walk_stop(const struct smem_block *block, void *ctx)
+{
+    (void)ctx;
+    return block->used ? 0 : 1;
+}
+
+TEST_F(SmallMemTest, mem_walk_test)
+{
+    uint8_t *mem;
+    struct small_mem *heap;
+    std::vector<struct smem_block> blocks;
+    std::vector<uint32_t> dump;
+    struct smem_dump_header *header;
+    struct smem_dump_record *record;
+    void *ptr[3];
+    size_t i, size;
+
+    mem = (uint8_t *)malloc(TEST_MEM_SIZE * 3);
+    ASSERT_NE(mem, nullptr);
+    /* first fit places the blocks from the bottom of the heap */
+    heap = (struct small_mem *)smem_init_ex(mem, TEST_MEM_SIZE * 2, SMEM_POLICY_FIRST_FIT);
+    ASSERT_NE(heap, nullptr);
+    ASSERT_EQ(smem_add_region(heap, mem + TEST_MEM_SIZE * 2, TEST_MEM_SIZE), 0);
+    ptr[0] = smem_alloc(heap, 64);
+    ptr[1] = smem_alloc(heap, 128);
+    ptr[2] = smem_alloc(heap, 64);
+    smem_free(ptr[1]);
+    settle(heap);
+    /* Blocks come in address order, the region after the initial heap */
+    EXPECT_EQ(smem_walk(heap, mem_walk_collect, &blocks), 5u);
+    ASSERT_EQ(blocks.size(), 5u);
+    EXPECT_EQ(blocks[0].ptr, ptr[0]);
+    EXPECT_EQ(blocks[0].offset, 0u);
+    EXPECT_EQ(blocks[0].used, 1u);
+    EXPECT_EQ(blocks[1].ptr, ptr[1]);
+    EXPECT_EQ(blocks[1].used, 0u);
+    EXPECT_GE(blocks[1].size, 128u);
+    EXPECT_EQ(blocks[2].ptr, ptr[2]);
+    EXPECT_EQ(blocks[3].used, 0u);
+    EXPECT_EQ(blocks[3].area, 0u);
+    EXPECT_EQ(blocks[4].area, 1u);
+    EXPECT_EQ(blocks[4].offset, 0u);
+    EXPECT_EQ(blocks[4].used, 0u);
+    for (i = 1; i < 4; i++)
+        EXPECT_GT(blocks[i].offset, blocks[i - 1].offset);
+    /* The walk stops when the callback asks for it */
+    EXPECT_EQ(smem_walk(heap, mem_walk_stop, NULL), 2u);
+    /* A short buffer gets the header and the size of the whole map */
+    dump.resize(sizeof(struct smem_dump_header) / sizeof(uint32_t));
+    size = smem_dump(heap, dump.data(), dump.size() * sizeof(uint32_t));
+    EXPECT_EQ(size, sizeof(struct smem_dump_header) + 5 * sizeof(struct smem_dump_record));
+    header = (struct smem_dump_header *)dump.data();
+    EXPECT_EQ(header->magic, (uint32_t)SMEM_DUMP_MAGIC);
+    EXPECT_EQ(header->count, 0u);
+    EXPECT_EQ(header->areas, 2u);
+    /* The records match the walk */
+    dump.resize(size / sizeof(uint32_t));
+    EXPECT_EQ(smem_dump(heap, dump.data(), size), size);
+    header = (struct smem_dump_header *)dump.data();
+    record = (struct smem_dump_record *)(header + 1);
+    ASSERT_EQ(header->count, 5u);
+    for (i = 0; i < header->count; i++)
+    {
+        EXPECT_EQ((size_t)record[i].offset * header->align, blocks[i].offset);
+        EXPECT_EQ((size_t)(record[i].info >> 1) * header->align, blocks[i].size);
+        EXPECT_EQ(record[i].info & SMEM_DUMP_USED, blocks[i].used);
+    }
+    smem_free(ptr[0]);
+    smem_free(ptr[2]);
+    smem_tcache_flush();
+    /* release test resources */
+    free(mem);
+}
+
+/* the per-thread cache takes small blocks before the quick lists */
+#if SMEM_USING_QUICK_LIST && !SMEM_USING_THREAD_SAFE
+TEST_F(SmallMemTest, mem_quick_list_test)
+{
+    std::vector<void *> blocks;
+    struct small_mem *heap;
+    size_t total, used, i;
+    uint8_t *mem;
+    void *ptr[4], *big;
+
+    mem = (uint8_t *)malloc(TEST_MEM_SIZE * 16);
+    ASSERT_NE(mem, nullptr);
+    heap = (struct small_mem *)smem_init_ex(mem, TEST_MEM_SIZE * 16, SMEM_POLICY_FIRST_FIT);
+    ASSERT_NE(heap, nullptr);
+    total = max_block(heap);
+    for (i = 0; i < 4; i++)
+    {
+        ptr[i] = smem_alloc(heap, 64);
+        ASSERT_NE(ptr[i], nullptr);
+    }
+    used = heap->parent.used;
+    /* Freed blocks wait unmerged and a request of the same size takes them back */
+    smem_free(ptr[1]);
+    smem_free(ptr[2]);
+    EXPECT_EQ(heap->quick_count, 2u);
+    EXPECT_LT(heap->parent.used, used);
+    EXPECT_EQ(smem_alloc(heap, 64), ptr[2]);
+    EXPECT_EQ(smem_alloc(heap, 64), ptr[1]);
+    EXPECT_EQ(heap->parent.used, used);
+    /* Merged, the two holes take a larger block */
+    smem_free(ptr[1]);
+    smem_free(ptr[2]);
+    EXPECT_EQ(smem_coalesce(heap), 2u);
+    EXPECT_EQ(heap->quick_count, 0u);
+    big = smem_alloc(heap, 128);
+    EXPECT_EQ(big, ptr[1]);
+    smem_free(big);
+    /* A failed search merges the waiting blocks and tries again */
+    while ((big = smem_alloc(heap, 64)) != nullptr)
+        blocks.push_back(big);
+    for (void *block : blocks)
+        smem_free(block);
+    blocks.clear();
+    EXPECT_NE(heap->quick_count, 0u);
+    big = smem_alloc(heap, TEST_MEM_SIZE * 8);
+    EXPECT_NE(big, nullptr);
+    EXPECT_EQ(heap->quick_count, 0u);
+    smem_free(big);
+    /* Enough waiting blocks start a merge pass */
+    for (i = 0; i < SMEM_QUICK_THRESHOLD + 1; i++)
+    {
+        blocks.push_back(smem_alloc(heap, 8));
+        ASSERT_NE(blocks.back(), nullptr);
+    }
+    for (void *block : blocks)
+        smem_free(block);
+    EXPECT_EQ(heap->quick_count, 1u);
+    smem_free(ptr[0]);
+    smem_free(ptr[3]);
+    EXPECT_EQ(max_block(heap), total);
+    smem_deinit(heap);
+    /* release test resources */
+    free(mem);
+}
+#endif
+
+#define MEM_HANDLE_TEST_COUNT 16
+#define MEM_HANDLE_TEST_SIZE 200
+
+TEST_F(SmallMemTest, mem_handle_test)
+{
+    static const enum smem_policy policies[] = {SMEM_POLICY_SEGREGATED, SMEM_POLICY_TLSF, SMEM_POLICY_BITMAP,
+                                                SMEM_POLICY_FIRST_FIT, SMEM_POLICY_BEST_FIT};
+    smem_handle_t handle[MEM_HANDLE_TEST_COUNT];
+    struct small_mem *heap;
+    size_t i, j, largest, moved;
+    uint8_t *mem, *pinned, *ptr;
+    void *big;
+
+    mem = (uint8_t *)malloc(TEST_MEM_SIZE * 8);
+    ASSERT_NE(mem, nullptr);
+    for (const enum smem_policy policy : policies)
+    {
+        heap = (struct small_mem *)smem_init_ex(mem, TEST_MEM_SIZE * 8, policy);
+        ASSERT_NE(heap, nullptr);
+        for (i = 0; i < MEM_HANDLE_TEST_COUNT; i++)
+        {
+            handle[i] = smem_halloc(heap, MEM_HANDLE_TEST_SIZE);
+            ASSERT_NE(handle[i], nullptr);
+            ptr = (uint8_t *)smem_hlock(handle[i]);
+            memset(ptr, (int)i, MEM_HANDLE_TEST_SIZE);
+            smem_hunlock(handle[i]);
+        }
+        /* Every other handle is released, leaving holes between the blocks */
+        for (i = 0; i < MEM_HANDLE_TEST_COUNT; i += 2)
+        {
+            smem_hfree(handle[i]);
+            handle[i] = nullptr;
+        }
+        largest = max_block(heap);
+        /* A locked block stays in place */
+        pinned = (uint8_t *)smem_hlock(handle[7]);
+        EXPECT_LE(smem_compact(heap, 1), 1u);
+        /* Bounded steps resume where the previous one stopped */
+        moved = 0;
+        for (i = 0; i < MEM_HANDLE_TEST_COUNT * 2; i++)
+            moved += smem_compact(heap, 4);
+        EXPECT_GT(moved, 0u);
+        EXPECT_EQ(smem_hlock(handle[7]), pinned);
+        smem_hunlock(handle[7]);
+        smem_hunlock(handle[7]);
+        /* Unlocked blocks slide down over the holes, the free space gathers at the top */
+        for (i = 0; i < MEM_HANDLE_TEST_COUNT * 2; i++)
+            smem_compact(heap, 4);
+        EXPECT_GE(max_block(heap), largest + (MEM_HANDLE_TEST_COUNT / 2 - 1) * MEM_HANDLE_TEST_SIZE);
+        big = smem_alloc(heap, largest + MEM_HANDLE_TEST_SIZE * 2);
+        EXPECT_NE(big, nullptr);
+        /* The data moves with the blocks */
+        for (i = 1; i < MEM_HANDLE_TEST_COUNT; i += 2)
+        {
+            ptr = (uint8_t *)smem_hlock(handle[i]);
+            for (j = 0; j < MEM_HANDLE_TEST_SIZE; j++)
+            {
+                if (ptr[j] != (uint8_t)i)
+                    break;
+            }
+            EXPECT_EQ(j, (size_t)MEM_HANDLE_TEST_SIZE);
+            smem_hunlock(handle[i]);
+            smem_hfree(handle[i]);
+        }
+        smem_free(big);
+        smem_tcache_flush();
+        smem_deinit(heap);
+    }
+    /* release test resources */
+    free(mem);
+}
+
+TEST_F(SmallMemTest, mem_realloc_compact_test)
+{
+    struct small_mem *heap;
+    uint8_t *mem, *nptr;
+    void *ptr[6];
+
+    mem = (uint8_t *)malloc(TEST_MEM_SIZE * 4);
+    ASSERT_NE(mem, nullptr);
+    heap = (struct small_mem *)smem_init(mem, TEST_MEM_SIZE * 4);
+    ASSERT_NE(heap, nullptr);
+    for (int i = 0; i < 6; i++)
+    {
+        ptr[i] = smem_alloc(heap, 64);
+        ASSERT_NE(ptr[i], nullptr);
+    }
+    /* A bounded step leaves the compaction cursor on the fifth block */
+    smem_free(ptr[0]);
+    smem_free(ptr[2]);
+    settle(heap);
+    smem_compact(heap, 2);
+    /* The block grows down over the freed ones below it, its old header becomes user data */
+    smem_free(ptr[3]);
+    settle(heap);
+    nptr = (uint8_t *)smem_realloc(heap, ptr[4], 160);
+    ASSERT_NE(nptr, nullptr);
+    EXPECT_EQ(nptr, ptr[2]);
+    memset(nptr, 0x41, 160);
+    /* The next step must not walk the overwritten header */
+    smem_compact(heap, 16);
+    for (int i = 0; i < 160; i++)
+        ASSERT_EQ(nptr[i], 0x41);
+    smem_free(nptr);
+    smem_free(ptr[1]);
+    smem_free(ptr[5]);
+    settle(heap);
+    EXPECT_EQ(heap->parent.used, 0);
+    smem_deinit(heap);
+    /* release test resources */
+    free(mem);
+}
+
+/* providers map memory anywhere, mostly out of reach of compact header offsets */
+#if !SMEM_USING_COMPACT_HEADER
+struct mem_test_provider
+{
+    int grown;
+    int trimmed;
+};
+
+static void *mem_test_grow(size_t size, size_t *actual, void *arg)
+{
+    struct mem_test_provider *provider = (struct mem_test_provider *)arg;
+
+    provider->grown++;
+    *actual = size;
+    return malloc(size);
+}
+
+static void mem_test_trim(void *addr, size_t size, void *arg)
+{
+    struct mem_test_provider *provider = (struct mem_test_provider *)arg;
+
+    (void)size;
+    provider->trimmed++;
+    free(addr);
+}
+
+TEST_F(SmallMemTest, mem_grow_test)
+{
+    uint8_t *buf;
+    struct small_mem *heap;
+    struct mem_test_provider provider = {0, 0};
+    size_t total_size;
+    void *ptr[4];
+
+    buf = (uint8_t *)malloc(TEST_MEM_SIZE);
+    EXPECT_NE(buf, nullptr);
+    heap = (struct small_mem *)smem_init(buf, TEST_MEM_SIZE);
+    total_size = heap->parent.total;
+    /* Without a provider the heap stays as it is */
+    EXPECT_EQ(smem_alloc(heap, TEST_MEM_SIZE * 2), nullptr);
+    EXPECT_EQ(smem_trim(heap), 0u);
+    smem_set_provider(heap, mem_test_grow, mem_test_trim, &provider);
+    /* Large requests get a region of their own, small ones share one */
+    ptr[0] = smem_alloc(heap, SMEM_GROW_MIN_SIZE * 2);
+    ASSERT_NE(ptr[0], nullptr);
+    memset(ptr[0], 0x5A, SMEM_GROW_MIN_SIZE * 2);
+    EXPECT_EQ(provider.grown, 1);
+    ptr[1] = smem_alloc(heap, TEST_MEM_SIZE);
+    ptr[2] = smem_alloc(heap, TEST_MEM_SIZE);
+    ASSERT_NE(ptr[1], nullptr);
+    ASSERT_NE(ptr[2], nullptr);
+    EXPECT_EQ(provider.grown, 2);
+    ptr[3] = smem_alloc(heap, 64);
+    ASSERT_NE(ptr[3], nullptr);
+    EXPECT_GT(heap->parent.total, total_size + SMEM_GROW_MIN_SIZE * 2);
+    /* Regions holding a used block stay */
+    smem_free(ptr[0]);
+    smem_free(ptr[1]);
+    smem_tcache_flush();
+    EXPECT_GE(smem_trim(heap), SMEM_GROW_MIN_SIZE * 2u);
+    EXPECT_EQ(provider.trimmed, 1);
+    smem_free(ptr[2]);
+    smem_free(ptr[3]);
+    smem_tcache_flush();
+    EXPECT_GE(smem_trim(heap), (size_t)SMEM_GROW_MIN_SIZE);
+    EXPECT_EQ(provider.trimmed, 2);
+    EXPECT_EQ(heap->parent.total, total_size);
+    EXPECT_EQ(heap->parent.used, 0u);
+    EXPECT_EQ(max_block(heap), total_size);
+#if SMEM_PORT_MMAP
+    /* The mmap provider works the same way */
+    smem_set_provider(heap, smem_port_page_alloc, smem_port_page_free, NULL);
+    ptr[0] = smem_alloc(heap, SMEM_GROW_MIN_SIZE);
+    ASSERT_NE(ptr[0], nullptr);
+    memset(ptr[0], 0x5A, SMEM_GROW_MIN_SIZE);
+    smem_free(ptr[0]);
+    smem_tcache_flush();
+    EXPECT_GE(smem_trim(heap), (size_t)SMEM_GROW_MIN_SIZE);
+    EXPECT_EQ(heap->parent.total, total_size);
+#endif
+    /* release test resources */
+    free(buf);
+}
+#endif
+
+TEST_F(SmallMemTest, mem_header_test)
+{
+    uint8_t *buf;
+    struct small_mem *heap;
+    size_t header = SMEM_ALIGN(sizeof(struct small_mem_item), SMEM_ALIGN_SIZE);
+    void *ptr[2];
+
+    buf = (uint8_t *)malloc(TEST_MEM_SIZE);
+    EXPECT_NE(buf, nullptr);
+    heap = (struct small_mem *)smem_init(buf, TEST_MEM_SIZE);
+    ASSERT_NE(heap, nullptr);
+    /* Adjacent blocks are one header apart */
+    ptr[0] = smem_alloc(heap, 1);
+    ptr[1] = smem_alloc(heap, 1);
+    ASSERT_NE(ptr[0], nullptr);
+    ASSERT_NE(ptr[1], nullptr);
+    EXPECT_EQ((size_t)((uint8_t *)ptr[1] - (uint8_t *)ptr[0]), smem_usable_size(ptr[0]) + header);
+    EXPECT_EQ(smem_owner(ptr[0]), heap);
+    EXPECT_EQ(smem_owner(ptr[1]), heap);
+#if SMEM_USING_COMPACT_HEADER
+    EXPECT_EQ(sizeof(struct small_mem_item), 8u);
+    EXPECT_EQ(smem_usable_size(ptr[0]), SMEM_ALIGN(2 * sizeof(void *), SMEM_ALIGN_SIZE));
+    /* The owner of a block is found by address */
+    smem_deinit(heap);
+    EXPECT_EQ(smem_owner(ptr[0]), nullptr);
+    heap = (struct small_mem *)smem_init(buf, TEST_MEM_SIZE);
+    ptr[0] = smem_alloc(heap, 1);
+    ASSERT_NE(ptr[0], nullptr);
+    EXPECT_EQ(smem_owner(ptr[0]), heap);
+#endif
+    smem_free(ptr[0]);
+    smem_tcache_flush();
+    smem_deinit(heap);
+    /* release test resources */
+    free(buf);
+}
+
+#if SMEM_USING_STATS
+TEST_F(SmallMemTest, mem_stats_test)
+{
+    uint8_t *buf;
+    struct small_mem *heap;
+    struct smem_stats stats;
+    void *ptr[3], *nptr;
+
+    buf = (uint8_t *)malloc(TEST_MEM_SIZE * 8);
+    EXPECT_NE(buf, nullptr);
+    heap = (struct small_mem *)smem_init(buf, TEST_MEM_SIZE * 8);
+    ASSERT_NE(heap, nullptr);
+    /* A fresh heap is one free block */
+    smem_get_stats(heap, &stats);
+    EXPECT_EQ(stats.total, heap->parent.total);
+    EXPECT_EQ(stats.live_blocks, 0u);
+    EXPECT_EQ(stats.free_blocks, 1u);
+    EXPECT_EQ(stats.largest_free, stats.free_size);
+    EXPECT_EQ(stats.fragmentation, 0u);
+    /* A hole in the middle fragments the free memory */
+    ptr[0] = smem_alloc(heap, 64);
+    ptr[1] = smem_alloc(heap, 256);
+    ptr[2] = smem_alloc(heap, 64);
+    smem_free(ptr[1]);
+    settle(heap);
+    smem_get_stats(heap, &stats);
+    EXPECT_EQ(stats.counters.alloc_count, 3u);
+    EXPECT_EQ(stats.counters.free_count, 1u);
+    EXPECT_EQ(stats.live_blocks, 2u);
+    EXPECT_EQ(stats.free_blocks, 2u);
+    EXPECT_EQ(stats.used, heap->parent.used);
+    EXPECT_GT(stats.fragmentation, 0u);
+    EXPECT_GT(stats.counters.searches, 0u);
+    EXPECT_GT(stats.counters.search_steps, 0u);
+    /* Resizes in place and by a move are told apart */
+    nptr = smem_realloc(heap, ptr[0], 32);
+    EXPECT_EQ(nptr, ptr[0]);
+    nptr = smem_realloc(heap, ptr[2], TEST_MEM_SIZE);
+    ASSERT_NE(nptr, nullptr);
+    ptr[2] = nptr;
+    EXPECT_EQ(smem_realloc(heap, ptr[2], TEST_MEM_SIZE * 16), nullptr);
+    EXPECT_EQ(smem_alloc(heap, TEST_MEM_SIZE * 16), nullptr);
+    smem_get_stats(heap, &stats);
+    EXPECT_EQ(stats.counters.realloc_count, 2u);
+    EXPECT_EQ(stats.counters.realloc_inplace + stats.counters.realloc_moved, 2u);
+    EXPECT_EQ(stats.counters.failed_count, 2u);
+    smem_free(ptr[0]);
+    smem_free(ptr[2]);
+    settle(heap);
+    smem_get_stats(heap, &stats);
+    EXPECT_EQ(stats.counters.free_count, 3u);
+    EXPECT_EQ(stats.live_blocks, 0u);
+    EXPECT_EQ(stats.free_blocks, 1u);
+    /* release test resources */
+    free(buf);
+}
+#endif
+
+#if SMEM_USING_HOOK
+struct hook_record
+{
+    int pre;
+    int post;
+    struct smem_hook_info last;
+};
+
+static void hook_pre(struct small_mem *m, const struct smem_hook_info *info, void *tag)
+{
+    struct hook_record *record = (struct hook_record *)tag;
+
+    (void)m;
+    EXPECT_EQ(info->cycles, 0u);
+    record->pre++;
+}
+
+static void hook_post(struct small_mem *m, const struct smem_hook_info *info, void *tag)
+{
+    struct hook_record *record = (struct hook_record *)tag;
+
+    (void)m;
+    record->post++;
+    record->last = *info;
+}
+
+TEST_F(SmallMemTest, mem_hook_test)
+{
+    uint8_t *buf;
+    struct small_mem *heap;
+    struct hook_record record;
+    void *ptr, *nptr;
+
+    /* room for the handle chunk next to the control block of every configuration */
+    buf = (uint8_t *)malloc(TEST_MEM_SIZE * 4);
+    EXPECT_NE(buf, nullptr);
+    heap = (struct small_mem *)smem_init(buf, TEST_MEM_SIZE * 4);
+    ASSERT_NE(heap, nullptr);
+    memset(&record, 0, sizeof(record));
+    smem_set_hooks(heap, hook_pre, hook_post, &record);
+    /* An allocation reports the requested and the rounded size */
+    ptr = smem_alloc(heap, 13);
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_EQ(record.pre, 1);
+    EXPECT_EQ(record.post, 1);
+    EXPECT_EQ(record.last.op, SMEM_HOOK_ALLOC);
+    EXPECT_EQ(record.last.ptr, ptr);
+    EXPECT_EQ(record.last.size, 13u);
+    EXPECT_EQ(record.last.rounded, smem_usable_size(ptr));
+    EXPECT_GE(record.last.rounded, 16u);
+    /* A resize reports the old and the new block once */
+    nptr = smem_realloc(heap, ptr, 200);
+    ASSERT_NE(nptr, nullptr);
+    EXPECT_EQ(record.post, 2);
+    EXPECT_EQ(record.last.op, SMEM_HOOK_REALLOC);
+    EXPECT_EQ(record.last.old_ptr, ptr);
+    EXPECT_EQ(record.last.ptr, nptr);
+    EXPECT_EQ(record.last.size, 200u);
+    ptr = nptr;
+    /* A failed allocation is reported too */
+    EXPECT_EQ(smem_alloc(heap, TEST_MEM_SIZE * 8), nullptr);
+    EXPECT_EQ(record.post, 3);
+    EXPECT_EQ(record.last.ptr, nullptr);
+    EXPECT_EQ(record.last.rounded, 0u);
+    /* A release reports the usable size of the block */
+    smem_free(ptr);
+    EXPECT_EQ(record.pre, 4);
+    EXPECT_EQ(record.post, 4);
+    EXPECT_EQ(record.last.op, SMEM_HOOK_FREE);
+    EXPECT_EQ(record.last.ptr, ptr);
+    EXPECT_GE(record.last.size, 200u);
+    /* Every block of a batch is reported */
+    void *ptrs[3];
+    size_t size;
+    EXPECT_EQ(smem_alloc_batch(heap, 24, 3, ptrs), 3u);
+    EXPECT_EQ(record.post, 7);
+    EXPECT_EQ(record.last.op, SMEM_HOOK_ALLOC);
+    EXPECT_EQ(record.last.ptr, ptrs[2]);
+    EXPECT_EQ(record.last.size, 24u);
+    /* In place resizes report the block and its usable size after the call */
+    size = smem_try_expand(heap, ptrs[2], 64);
+    EXPECT_EQ(record.post, 8);
+    EXPECT_EQ(record.last.op, SMEM_HOOK_EXPAND);
+    EXPECT_EQ(record.last.ptr, ptrs[2]);
+    EXPECT_EQ(record.last.old_ptr, ptrs[2]);
+    EXPECT_EQ(record.last.size, 64u);
+    EXPECT_EQ(record.last.rounded, size);
+    size = smem_try_shrink(heap, ptrs[2], 16);
+    EXPECT_EQ(record.post, 9);
+    EXPECT_EQ(record.last.op, SMEM_HOOK_SHRINK);
+    EXPECT_EQ(record.last.rounded, size);
+    smem_free_batch(ptrs, 3);
+    EXPECT_EQ(record.pre, 12);
+    EXPECT_EQ(record.post, 12);
+    EXPECT_EQ(record.last.op, SMEM_HOOK_FREE);
+    /* Handle blocks are reported as the blocks holding them, a move by compaction reaches the post hook */
+    settle(heap);
+    ptr = smem_alloc(heap, 64);
+    smem_handle_t handle = smem_halloc(heap, 32);
+    ASSERT_NE(handle, nullptr);
+    EXPECT_EQ(record.post, 14);
+    EXPECT_EQ(record.last.op, SMEM_HOOK_ALLOC);
+    nptr = record.last.ptr;
+    smem_free(ptr);
+    settle(heap);
+    EXPECT_GE(smem_compact(heap, 16), 1u);
+    EXPECT_EQ(record.pre, 15);
+    EXPECT_EQ(record.last.op, SMEM_HOOK_MOVE);
+    EXPECT_EQ(record.last.old_ptr, nptr);
+    EXPECT_LT(record.last.ptr, nptr);
+    nptr = record.last.ptr;
+    smem_hfree(handle);
+    EXPECT_EQ(record.last.op, SMEM_HOOK_FREE);
+    EXPECT_EQ(record.last.ptr, nptr);
+    EXPECT_EQ(record.post, 17);
+    /* No hook runs once they are removed */
+    smem_set_hooks(heap, NULL, NULL, NULL);
+    ptr = smem_alloc(heap, 64);
+    smem_free(ptr);
+    EXPECT_EQ(record.post, 17);
+    smem_tcache_flush();
+    /* release test resources */
+    free(buf);
+}
+#endif
+
+#if SMEM_USING_THREAD_SAFE
+
+#define MEM_THREAD_TEST_THREADS 4
+#define MEM_THREAD_TEST_COUNT 32
+#define MEM_THREAD_TEST_LOOP 20000
+
+TEST_F(SmallMemTest, mem_thread_safe_test)
+{
+    uint8_t *buf;
+    struct small_mem *heap;
+    size_t total_size;
+    std::vector<std::thread> threads;
+    int errors[MEM_THREAD_TEST_THREADS] = {0};
+
+    buf = (uint8_t *)malloc(TEST_MEM_SIZE * 64);
+    EXPECT_NE(buf, nullptr);
+    heap = (struct small_mem *)smem_init(buf, TEST_MEM_SIZE * 64);
+    total_size = max_block(heap);
+    for (int t = 0; t < MEM_THREAD_TEST_THREADS; t++)
+    {
+        threads.emplace_back([heap, t, &errors]() {
+            struct mem_test_context ctx[MEM_THREAD_TEST_COUNT];
+            unsigned int seed = t;
+            size_t i, idx;
+
+            memset(ctx, 0, sizeof(ctx));
+            for (i = 0; i < MEM_THREAD_TEST_LOOP; i++)
+            {
+                idx = rand_r(&seed) % MEM_THREAD_TEST_COUNT;
+                if (ctx[idx].ptr != nullptr)
+                {
+                    for (size_t j = 0; j < ctx[idx].size; j++)
+                    {
+                        if (((uint8_t *)ctx[idx].ptr)[j] != ctx[idx].magic)
+                            errors[t]++;
+                    }
+                    smem_free(ctx[idx].ptr);
+                    ctx[idx].ptr = nullptr;
+                    continue;
+                }
+                ctx[idx].size = rand_r(&seed) % 128 + 1;
+                ctx[idx].magic = t * MEM_THREAD_TEST_COUNT + idx;
+                ctx[idx].ptr = smem_alloc(heap, ctx[idx].size);
+                if (ctx[idx].ptr != nullptr)
+                    memset(ctx[idx].ptr, ctx[idx].magic, ctx[idx].size);
+            }
+            for (idx = 0; idx < MEM_THREAD_TEST_COUNT; idx++)
+                smem_free(ctx[idx].ptr);
+            /* Give the cached blocks back before the thread exits */
+            smem_tcache_flush();
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    for (int t = 0; t < MEM_THREAD_TEST_THREADS; t++)
+    {
+        EXPECT_EQ(errors[t], 0);
+    }
+    /* Check whether the memory is fully merged */
+    settle(heap);
+    EXPECT_EQ(heap->parent.used, 0);
+    EXPECT_EQ(max_block(heap), total_size);
+    /* release test resources */
+    free(buf);
+}
+
+#if SMEM_USING_COMPACT_HEADER
+#define MEM_REGISTRY_TEST_LOOP 200
+
+TEST_F(SmallMemTest, mem_registry_thread_test)
+{
+    uint8_t *buf;
+    struct small_mem *heap;
+    std::vector<std::thread> threads;
+    int errors[MEM_THREAD_TEST_THREADS] = {0};
+
+    buf = (uint8_t *)malloc(TEST_MEM_SIZE * 16);
+    EXPECT_NE(buf, nullptr);
+    heap = (struct small_mem *)smem_init(buf, TEST_MEM_SIZE * 16);
+    ASSERT_NE(heap, nullptr);
+    /* Every thread registers and drops heaps of its own while freeing into the shared one */
+    for (int t = 0; t < MEM_THREAD_TEST_THREADS; t++)
+    {
+        threads.emplace_back([heap, t, &errors]() {
+            uint8_t *own_buf;
+            smem_t own;
+            void *ptr[2];
+
+            own_buf = (uint8_t *)malloc(TEST_MEM_SIZE);
+            for (int i = 0; i < MEM_REGISTRY_TEST_LOOP; i++)
+            {
+                own = smem_init(own_buf, TEST_MEM_SIZE);
+                ptr[0] = smem_alloc(own, 16);
+                ptr[1] = smem_alloc(heap, 16);
+                if (own == nullptr || ptr[0] == nullptr || ptr[1] == nullptr)
+                {
+                    errors[t]++;
+                    break;
+                }
+                if (smem_owner(ptr[0]) != own || smem_owner(ptr[1]) != heap)
+                    errors[t]++;
+                smem_free(ptr[1]);
+                /* A block of a dropped heap has no owner any more */
+                smem_deinit(own);
+                if (smem_owner(ptr[0]) != nullptr)
+                    errors[t]++;
+            }
+            smem_tcache_flush();
+            free(own_buf);
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    for (int t = 0; t < MEM_THREAD_TEST_THREADS; t++)
+    {
+        EXPECT_EQ(errors[t], 0);
+    }
+    settle(heap);
+    EXPECT_EQ(heap->parent.used, 0);
+    smem_deinit(heap);
+    /* release test resources */
+    free(buf);
+}
+#endif
+
+#if SMEM_USING_REMOTE_FREE
+#define MEM_REMOTE_TEST_COUNT 256
+
+TEST_F(SmallMemTest, mem_remote_free_test)
+{
+    uint8_t *buf;
+    struct small_mem *heap;
+    size_t total_size, used;
+    std::vector<void *> blocks;
+    std::vector<std::thread> threads;
+    void *ptr;
+
+    buf = (uint8_t *)malloc(TEST_MEM_SIZE * 64);
+    ASSERT_NE(buf, nullptr);
+    heap = (struct small_mem *)smem_init(buf, TEST_MEM_SIZE * 64);
+    ASSERT_NE(heap, nullptr);
+    total_size = max_block(heap);
+    used = heap->parent.used;
+    /* A heap without owner is freed into directly by every thread */
+    ptr = smem_alloc(heap, 64);
+    std::thread([ptr]() {
+        smem_free(ptr);
+        smem_tcache_flush();
+    }).join();
+    EXPECT_EQ(heap->remote, nullptr);
+    EXPECT_EQ(max_block(heap), total_size);
+    smem_set_owner(heap);
+    for (int i = 0; i < MEM_REMOTE_TEST_COUNT; i++)
+    {
+        blocks.push_back(smem_alloc(heap, i % 128 + 1));
+        ASSERT_NE(blocks.back(), nullptr);
+    }
+    /* Other threads queue their frees, the blocks stay used */
+    for (int t = 0; t < MEM_THREAD_TEST_THREADS; t++)
+    {
+        threads.emplace_back([&blocks, t]() {
+            for (size_t i = t; i < blocks.size(); i += MEM_THREAD_TEST_THREADS)
+                smem_free(blocks[i]);
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_NE(heap->remote, nullptr);
+    EXPECT_GT(heap->parent.used, used);
+    /* The next allocation of the owner releases them */
+    ptr = smem_alloc(heap, TEST_MEM_SIZE * 32);
+    EXPECT_NE(ptr, nullptr);
+    EXPECT_EQ(heap->remote, nullptr);
+    smem_free(ptr);
+    EXPECT_EQ(max_block(heap), total_size);
+    /* A batch of another thread is queued as a whole */
+    blocks.resize(8);
+    ASSERT_EQ(smem_alloc_batch(heap, 32, blocks.size(), blocks.data()), blocks.size());
+    std::thread([&blocks]() {
+        smem_free_batch(blocks.data(), blocks.size());
+    }).join();
+    EXPECT_NE(heap->remote, nullptr);
+    EXPECT_EQ(smem_remote_drain(heap), blocks.size());
+    EXPECT_EQ(max_block(heap), total_size);
+    /* A new owner frees directly */
+    ptr = smem_alloc(heap, 64);
+    std::thread([heap, ptr]() {
+        smem_set_owner(heap);
+        smem_free(ptr);
+        smem_tcache_flush();
+    }).join();
+    EXPECT_EQ(heap->remote, nullptr);
+    EXPECT_EQ(smem_remote_drain(heap), 0u);
+    smem_set_owner(heap);
+    EXPECT_EQ(max_block(heap), total_size);
+    /* release test resources */
+    free(buf);
+}
+#endif
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2006-2024, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <gtest/gtest.h>
+#include <small_mem/inc/smem.h>
+#include <small_mem/inc/smem.hpp>
+#include "smem_test.h"
+
+#define TEST_PMR_HEAP_SIZE (64 * 1024)
+
+class SmallMemPmrTest : public SmallMemHeapTest<TEST_PMR_HEAP_SIZE>
+{
+protected:
+    void SetUp() override
+    {
+        SmallMemHeapTest::SetUp();
+        if (!HasFatalFailure())
+            base = heap_used();
+    }
+
+    void TearDown() override
+    {
+        /* every container gave its memory back */
+        EXPECT_EQ(heap_used(), base);
+        SmallMemHeapTest::TearDown();
+    }
+
+    size_t base = 0;
+};
+
+TEST_F(SmallMemPmrTest, resource_test)
+{
+    smem::memory_resource resource(heap), other(heap);
+    void *ptr;
+
+    {
+        std::pmr::vector<int> vec(&resource);
+        std::pmr::unordered_map<int, std::pmr::string> map(&resource);
+
+        for (int i = 0; i < 256; i++)
+        {
+            vec.push_back(i);
+            map.emplace(i, std::pmr::string(64, (char)('a' + i % 26), &resource));
+        }
+        EXPECT_TRUE(in_heap(vec.data()));
+        EXPECT_TRUE(in_heap(map.at(7).data()));
+        EXPECT_EQ(map.at(27)[63], 'b');
+        EXPECT_GT(heap_used(), base);
+    }
+    EXPECT_EQ(heap_used(), base);
+
+    /* Over-aligned requests and zero sized ones */
+    ptr = resource.allocate(100, 256);
+    EXPECT_EQ((uintptr_t)ptr % 256, 0u);
+    EXPECT_TRUE(in_heap(ptr));
+    resource.deallocate(ptr, 100, 256);
+    ptr = resource.allocate(0);
+    EXPECT_NE(ptr, nullptr);
+    resource.deallocate(ptr, 0);
+
+    /* Resources of the same heap are interchangeable */
+    EXPECT_TRUE(resource.is_equal(other));
+    EXPECT_FALSE(resource.is_equal(*std::pmr::new_delete_resource()));
+    EXPECT_THROW((void)resource.allocate(TEST_PMR_HEAP_SIZE * 2), std::bad_alloc);
+}
+
+TEST_F(SmallMemPmrTest, allocator_test)
+{
+    struct alignas(64) wide
+    {
+        uint8_t data[64];
+    };
+    smem::allocator<int> alloc(heap);
+
+    {
+        std::vector<int, smem::allocator<int>> vec(alloc);
+        std::map<int, int, std::less<int>, smem::allocator<std::pair<const int, int>>> map(alloc);
+        std::vector<wide, smem::allocator<wide>> wides(alloc);
+
+        for (int i = 0; i < 256; i++)
+        {
+            vec.push_back(i);
+            map[i] = i * 2;
+        }
+        wides.resize(4);
+        EXPECT_TRUE(in_heap(vec.data()));
+        EXPECT_EQ(map[100], 200);
+        EXPECT_TRUE(in_heap(wides.data()));
+        EXPECT_EQ((uintptr_t)wides.data() % alignof(wide), 0u);
+        /* rebound copies share the heap */
+        EXPECT_TRUE(vec.get_allocator() == wides.get_allocator());
+    }
+
+    /* an empty request gets a block like do_allocate does */
+    int *ptr = alloc.allocate(0);
+    EXPECT_NE(ptr, nullptr);
+    EXPECT_TRUE(in_heap(ptr));
+    alloc.deallocate(ptr, 0);
+
+    EXPECT_THROW(alloc.allocate(TEST_PMR_HEAP_SIZE), std::bad_alloc);
+}
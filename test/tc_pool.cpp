@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2006-2024, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include <gtest/gtest.h>
+#include <small_mem/inc/smem.h>
+#include <small_mem/inc/smem_pool.h>
+#include <small_mem/inc/smem_port.h>
+#include "smem_test.h"
+
+#define TEST_POOL_HEAP_SIZE (16 * 1024)
+#define TEST_POOL_OBJ_SIZE 20
+#define TEST_POOL_OBJS_PER_SLAB 8
+
+class SmallMemPoolTest : public SmallMemHeapTest<TEST_POOL_HEAP_SIZE>
+{
+};
+
+TEST_F(SmallMemPoolTest, pool_functional_test)
+{
+    void *objs[TEST_POOL_OBJS_PER_SLAB * 3];
+    struct smem_pool_info info;
+    smem_pool_t pool;
+    size_t used;
+
+    EXPECT_EQ(smem_pool_create(heap, 0, TEST_POOL_OBJS_PER_SLAB), nullptr);
+    EXPECT_EQ(smem_pool_create(heap, TEST_POOL_OBJ_SIZE, 0), nullptr);
+    /* Slab sizes which do not fit a size_t are refused */
+    EXPECT_EQ(smem_pool_create(heap, SIZE_MAX, 1), nullptr);
+    EXPECT_EQ(smem_pool_create(heap, TEST_POOL_OBJ_SIZE, SIZE_MAX / TEST_POOL_OBJ_SIZE), nullptr);
+    pool = smem_pool_create(heap, TEST_POOL_OBJ_SIZE, TEST_POOL_OBJS_PER_SLAB);
+    ASSERT_NE(pool, nullptr);
+    used = heap_used();
+
+    /* Objects are aligned and spread over three slabs */
+    for (int i = 0; i < TEST_POOL_OBJS_PER_SLAB * 3; i++)
+    {
+        objs[i] = smem_pool_alloc(pool);
+        ASSERT_NE(objs[i], nullptr);
+        EXPECT_EQ((uintptr_t)objs[i] % SMEM_ALIGN_SIZE, 0u);
+        memset(objs[i], i, TEST_POOL_OBJ_SIZE);
+    }
+    for (int i = 0; i < TEST_POOL_OBJS_PER_SLAB * 3; i++)
+    {
+        EXPECT_EQ(((uint8_t *)objs[i])[TEST_POOL_OBJ_SIZE - 1], (uint8_t)i);
+    }
+    smem_pool_info(pool, &info);
+    EXPECT_EQ(info.obj_size, SMEM_ALIGN(TEST_POOL_OBJ_SIZE, SMEM_ALIGN_SIZE));
+    EXPECT_EQ(info.slabs, 3u);
+    EXPECT_EQ(info.total, TEST_POOL_OBJS_PER_SLAB * 3u);
+    EXPECT_EQ(info.used, TEST_POOL_OBJS_PER_SLAB * 3u);
+
+    /* Released objects are handed out again before a slab is added */
+    smem_pool_free(pool, objs[3]);
+    EXPECT_EQ(smem_pool_alloc(pool), objs[3]);
+
+    /* Slabs with live objects stay */
+    for (int i = 0; i < TEST_POOL_OBJS_PER_SLAB * 3; i += 2)
+    {
+        smem_pool_free(pool, objs[i]);
+    }
+    EXPECT_EQ(smem_pool_trim(pool), 0u);
+    smem_pool_info(pool, &info);
+    EXPECT_EQ(info.slabs, 3u);
+
+    /* Emptied slabs go back to the heap on their own, SMEM_POOL_KEEP_EMPTY of them wait for trim */
+    for (int i = 1; i < TEST_POOL_OBJS_PER_SLAB * 2; i += 2)
+    {
+        smem_pool_free(pool, objs[i]);
+    }
+    smem_pool_info(pool, &info);
+    EXPECT_EQ(info.slabs, 1u + (SMEM_POOL_KEEP_EMPTY < 2 ? SMEM_POOL_KEEP_EMPTY : 2));
+    EXPECT_EQ(smem_pool_trim(pool), info.slabs - 1);
+    smem_pool_info(pool, &info);
+    EXPECT_EQ(info.slabs, 1u);
+    EXPECT_EQ(info.used, TEST_POOL_OBJS_PER_SLAB / 2u);
+
+    /* The remaining slab still serves its free objects */
+    for (int i = 0; i < TEST_POOL_OBJS_PER_SLAB / 2; i++)
+    {
+        EXPECT_NE(smem_pool_alloc(pool), nullptr);
+    }
+    smem_pool_info(pool, &info);
+    EXPECT_EQ(info.slabs, 1u);
+
+    /* An empty pool gives every slab back */
+    for (int i = 0; i < TEST_POOL_OBJS_PER_SLAB * 2; i++)
+    {
+        objs[i] = smem_pool_alloc(pool);
+        ASSERT_NE(objs[i], nullptr);
+    }
+    EXPECT_GT(heap_used(), used);
+    smem_pool_destroy(pool);
+    EXPECT_EQ(heap_used(), 0u);
+}
+
+TEST_F(SmallMemPoolTest, pool_release_test)
+{
+    void *objs[TEST_POOL_OBJS_PER_SLAB];
+    struct smem_pool_info info;
+    smem_pool_t pool;
+    size_t used;
+
+    pool = smem_pool_create(heap, TEST_POOL_OBJ_SIZE, TEST_POOL_OBJS_PER_SLAB);
+    ASSERT_NE(pool, nullptr);
+    used = heap_used();
+    /* Filling and emptying a slab again and again keeps one slab at most */
+    for (int round = 0; round < 4; round++)
+    {
+        for (int i = 0; i < TEST_POOL_OBJS_PER_SLAB; i++)
+        {
+            objs[i] = smem_pool_alloc(pool);
+            ASSERT_NE(objs[i], nullptr);
+        }
+        for (int i = TEST_POOL_OBJS_PER_SLAB - 1; i >= 0; i--)
+        {
+            smem_pool_free(pool, objs[i]);
+        }
+        smem_pool_info(pool, &info);
+        EXPECT_EQ(info.used, 0u);
+        EXPECT_LE(info.slabs, (size_t)SMEM_POOL_KEEP_EMPTY);
+    }
+    /* Trim gives the kept slab back */
+    smem_pool_trim(pool);
+    EXPECT_EQ(heap_used(), used);
+    smem_pool_destroy(pool);
+    EXPECT_EQ(heap_used(), 0u);
+}
+
+TEST_F(SmallMemPoolTest, pool_exhausted_test)
+{
+    smem_pool_t pool;
+    size_t count = 0;
+
+    pool = smem_pool_create(heap, 64, 16);
+    ASSERT_NE(pool, nullptr);
+    while (smem_pool_alloc(pool) != nullptr)
+    {
+        count++;
+    }
+    EXPECT_GT(count, 0u);
+    EXPECT_EQ(count % 16, 0u);
+    smem_pool_destroy(pool);
+    EXPECT_EQ(heap_used(), 0u);
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2006-2024, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <small_mem/inc/smem.h>
+#include <small_mem/inc/smem_shard.h>
+#include "smem_test.h"
+
+#define TEST_SHARD_SIZE (64 * 1024)
+#define TEST_SHARD_COUNT 4
+
+class SmallMemShardTest : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        buf = (uint8_t *)malloc(TEST_SHARD_SIZE);
+        ASSERT_NE(buf, nullptr);
+    }
+
+    void TearDown() override
+    {
+        smem_tcache_flush();
+        free(buf);
+    }
+
+    size_t shard_used(smem_shard_t shard)
+    {
+        size_t used = 0;
+
+        for (uint32_t i = 0; i < shard->count; i++)
+        {
+            used += smem_test_used(shard->heaps[i]);
+        }
+        return used;
+    }
+
+    uint8_t *buf;
+};
+
+TEST_F(SmallMemShardTest, shard_functional_test)
+{
+    smem_shard_t shard;
+    void *ptr, *nptr;
+    smem_t heap;
+
+    EXPECT_EQ(smem_shard_init(buf, TEST_SHARD_SIZE, 0, SMEM_SHARD_ROUND_ROBIN), nullptr);
+    EXPECT_EQ(smem_shard_init(buf, TEST_SHARD_SIZE, SMEM_SHARD_MAX + 1, SMEM_SHARD_ROUND_ROBIN), nullptr);
+    shard = smem_shard_init(buf, TEST_SHARD_SIZE, TEST_SHARD_COUNT, SMEM_SHARD_ROUND_ROBIN);
+    ASSERT_NE(shard, nullptr);
+    EXPECT_EQ(shard->count, TEST_SHARD_COUNT);
+    /* A thread keeps its heap */
+    heap = smem_shard_heap(shard);
+    EXPECT_EQ(smem_shard_heap(shard), heap);
+    /* Blocks come from the heap of the thread and go back through smem_free */
+    ptr = smem_shard_alloc(shard, 100);
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_EQ(smem_owner(ptr), heap);
+    EXPECT_GE(smem_usable_size(ptr), 100);
+    memset(ptr, 0x5A, 100);
+    nptr = smem_shard_realloc(shard, ptr, 200);
+    ASSERT_NE(nptr, nullptr);
+    EXPECT_EQ(((uint8_t *)nptr)[99], 0x5A);
+    smem_free(nptr);
+    EXPECT_EQ(shard_used(shard), 0);
+    /* An exhausted heap falls back to the other heaps of the shard */
+    {
+        std::vector<void *> ptrs;
+        size_t large = TEST_SHARD_SIZE / TEST_SHARD_COUNT / 2;
+
+        for (int i = 0; i < TEST_SHARD_COUNT; i++)
+        {
+            ptr = smem_shard_alloc(shard, large);
+            EXPECT_NE(ptr, nullptr);
+            ptrs.push_back(ptr);
+        }
+        EXPECT_NE(smem_owner(ptrs[0]), smem_owner(ptrs[1]));
+        for (auto p : ptrs)
+        {
+            smem_free(p);
+        }
+    }
+    EXPECT_EQ(shard_used(shard), 0);
+#if SMEM_USING_REMOTE_FREE
+    /* The bound thread owns its heap, the frees of other threads are queued */
+    ptr = smem_shard_alloc(shard, 64);
+    ASSERT_NE(ptr, nullptr);
+    std::thread([ptr]() {
+        smem_free(ptr);
+    }).join();
+    EXPECT_NE(((struct small_mem *)heap)->remote, nullptr);
+    ptr = smem_shard_alloc(shard, 64);
+    EXPECT_EQ(((struct small_mem *)heap)->remote, nullptr);
+    smem_free(ptr);
+    EXPECT_EQ(shard_used(shard), 0);
+#endif
+}
+
+#if SMEM_USING_THREAD_SAFE
+
+#define TEST_SHARD_THREADS 8
+#define TEST_SHARD_LOOP 10000
+
+TEST_F(SmallMemShardTest, shard_thread_test)
+{
+    smem_shard_t shard;
+    std::vector<std::thread> threads;
+    std::vector<void *> handoff[TEST_SHARD_THREADS];
+
+    shard = smem_shard_init(buf, TEST_SHARD_SIZE, TEST_SHARD_COUNT, SMEM_SHARD_ROUND_ROBIN);
+    ASSERT_NE(shard, nullptr);
+    for (int t = 0; t < TEST_SHARD_THREADS; t++)
+    {
+        threads.emplace_back([shard, t, &handoff]() {
+            unsigned int seed = t;
+            void *ptr;
+
+            for (int i = 0; i < TEST_SHARD_LOOP; i++)
+            {
+                ptr = smem_shard_alloc(shard, rand_r(&seed) % 128 + 1);
+                if (ptr == nullptr)
+                    continue;
+                if (i % 16 == 0)
+                    handoff[t].push_back(ptr);
+                else
+                    smem_free(ptr);
+            }
+            smem_tcache_flush();
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    /* Blocks of other threads are released by the main thread */
+    for (int t = 0; t < TEST_SHARD_THREADS; t++)
+    {
+        for (auto p : handoff[t])
+        {
+            smem_free(p);
+        }
+    }
+    EXPECT_EQ(shard_used(shard), 0);
+}
+
+#endif
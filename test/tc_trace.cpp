@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2006-2024, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <gtest/gtest.h>
+#include <small_mem/inc/smem.h>
+#include <small_mem/inc/smem_trace.h>
+#include "smem_test.h"
+
+#if SMEM_USING_TRACE
+
+#define TEST_TRACE_HEAP_SIZE (16 * 1024)
+
+class SmallMemTraceTest : public SmallMemHeapTest<TEST_TRACE_HEAP_SIZE>
+{
+protected:
+    void SetUp() override
+    {
+        SmallMemHeapTest::SetUp();
+        path = testing::TempDir() + "smem_trace_test.bin";
+    }
+
+    void TearDown() override
+    {
+        remove(path.c_str());
+        SmallMemHeapTest::TearDown();
+    }
+
+    /* read the trace file back, the header first */
+    bool load(struct smem_trace_header *header, std::vector<struct smem_trace_record> &records)
+    {
+        FILE *file = fopen(path.c_str(), "rb");
+        bool ok;
+
+        if (file == NULL)
+            return false;
+        ok = fread(header, sizeof(*header), 1, file) == 1;
+        if (ok)
+        {
+            records.resize((size_t)header->count);
+            ok = fread(records.data(), sizeof(records[0]), records.size(), file) == records.size();
+            /* the file is cut after the last record */
+            ok = ok && fgetc(file) == EOF;
+        }
+        fclose(file);
+        return ok;
+    }
+
+    bool load_header(struct smem_trace_header *header)
+    {
+        FILE *file = fopen(path.c_str(), "rb");
+        bool ok;
+
+        if (file == NULL)
+            return false;
+        ok = fread(header, sizeof(*header), 1, file) == 1;
+        fclose(file);
+        return ok;
+    }
+
+    /* replay the handles, count the records naming a block which is not live */
+    size_t unmatched(const std::vector<struct smem_trace_record> &records)
+    {
+        std::unordered_set<uint32_t> live;
+        size_t count = 0;
+
+        for (const struct smem_trace_record &record : records)
+        {
+            if (record.old_id != 0 && live.erase(record.old_id) == 0)
+                count++;
+            /* a failed realloc keeps the old block */
+            if (record.id == 0 && record.old_id != 0 && record.size != 0)
+                live.insert(record.old_id);
+            if (record.id != 0 && !live.insert(record.id).second)
+                count++;
+        }
+        return count;
+    }
+
+    std::string path;
+};
+
+TEST_F(SmallMemTraceTest, record_test)
+{
+    struct small_mem_trace trace;
+    struct smem_trace_header header;
+    std::vector<struct smem_trace_record> records;
+    void *ptr[2];
+
+    ASSERT_EQ(smem_trace_start(&trace, heap, path.c_str(), 16), 0);
+    ptr[0] = smem_alloc(heap, 24);
+    ptr[1] = smem_alloc(heap, 100);
+    ptr[0] = smem_realloc(heap, ptr[0], 300);
+    EXPECT_EQ(smem_alloc(heap, TEST_TRACE_HEAP_SIZE * 2), nullptr);
+    smem_free(ptr[1]);
+    smem_free(ptr[0]);
+    EXPECT_EQ(smem_trace_stop(&trace), 6u);
+    /* Nothing is recorded once the recorder stopped */
+    smem_free(smem_alloc(heap, 8));
+
+    ASSERT_TRUE(load(&header, records));
+    EXPECT_EQ(header.magic, (uint32_t)SMEM_TRACE_MAGIC);
+    EXPECT_EQ(header.version, SMEM_TRACE_VERSION);
+    EXPECT_EQ(header.record_size, sizeof(struct smem_trace_record));
+    EXPECT_EQ(header.dropped, 0u);
+    ASSERT_EQ(records.size(), 6u);
+    /* Allocations get a handle, a realloc names the old and the new block */
+    EXPECT_EQ(records[0].op, (uint32_t)SMEM_TRACE_ALLOC);
+    EXPECT_EQ(records[0].size, 24u);
+    EXPECT_NE(records[0].id, 0u);
+    EXPECT_EQ(records[0].old_id, 0u);
+    EXPECT_NE(records[1].id, records[0].id);
+    /* A block keeps its handle when realloc moves it */
+    EXPECT_EQ(records[2].op, (uint32_t)SMEM_TRACE_REALLOC);
+    EXPECT_EQ(records[2].size, 300u);
+    EXPECT_EQ(records[2].old_id, records[0].id);
+    EXPECT_EQ(records[2].id, records[0].id);
+    /* A failed allocation has no handle */
+    EXPECT_EQ(records[3].id, 0u);
+    EXPECT_EQ(records[3].old_id, 0u);
+    /* Releases name the block only */
+    EXPECT_EQ(records[4].op, (uint32_t)SMEM_TRACE_FREE);
+    EXPECT_EQ(records[4].size, 0u);
+    EXPECT_EQ(records[4].id, 0u);
+    EXPECT_EQ(records[4].old_id, records[1].id);
+    EXPECT_EQ(records[5].old_id, records[2].id);
+    EXPECT_EQ(unmatched(records), 0u);
+}
+
+TEST_F(SmallMemTraceTest, coverage_test)
+{
+    struct small_mem_trace trace;
+    struct smem_trace_header header;
+    std::vector<struct smem_trace_record> records;
+    smem_handle_t handle;
+    void *ptrs[4], *ptr;
+
+    ASSERT_EQ(smem_trace_start(&trace, heap, path.c_str(), 64), 0);
+    /* A handle block keeps its handle when compaction moves it over the hole right below */
+    ptrs[0] = smem_alloc(heap, 128);
+    handle = smem_halloc(heap, 64);
+    ASSERT_NE(handle, nullptr);
+    ASSERT_LT((uint8_t *)ptrs[0], (uint8_t *)smem_hlock(handle));
+    smem_hunlock(handle);
+    smem_free(ptrs[0]);
+    smem_test_settle(heap);
+    EXPECT_GE(smem_compact(heap, 64), 1u);
+    /* An aligned allocation keeps its alignment */
+    ptr = smem_memalign(heap, 256, 40);
+    ASSERT_NE(ptr, nullptr);
+    /* Batches are recorded block by block */
+    ASSERT_EQ(smem_alloc_batch(heap, 32, 4, ptrs), 4u);
+    smem_free_batch(ptrs, 4);
+    /* In place resizes keep the handle and tell their operation */
+    ptr = smem_realloc(heap, ptr, 64);
+    (void)smem_try_shrink(heap, ptr, 16);
+    smem_hfree(handle);
+    smem_free(ptr);
+    EXPECT_EQ(smem_trace_stop(&trace), 16u);
+
+    ASSERT_TRUE(load(&header, records));
+    ASSERT_EQ(records.size(), 16u);
+    EXPECT_EQ(records[0].op, (uint32_t)SMEM_TRACE_ALLOC);
+    EXPECT_EQ(records[1].op, (uint32_t)SMEM_TRACE_ALLOC);
+    EXPECT_EQ(records[2].op, (uint32_t)SMEM_TRACE_FREE);
+    EXPECT_EQ(records[3].align, 256u);
+    EXPECT_EQ(records[4].align, 0u);
+    for (int i = 4; i <= 7; i++)
+    {
+        EXPECT_EQ(records[i].op, (uint32_t)SMEM_TRACE_ALLOC);
+        EXPECT_EQ(records[i].size, 32u);
+        EXPECT_NE(records[i].id, 0u);
+        EXPECT_EQ(records[i + 4].op, (uint32_t)SMEM_TRACE_FREE);
+        EXPECT_EQ(records[i + 4].id, 0u);
+        EXPECT_NE(records[i + 4].old_id, 0u);
+    }
+    EXPECT_EQ(records[12].op, (uint32_t)SMEM_TRACE_REALLOC);
+    EXPECT_EQ(records[12].id, records[3].id);
+    EXPECT_EQ(records[13].op, (uint32_t)SMEM_TRACE_SHRINK);
+    EXPECT_EQ(records[13].old_id, records[3].id);
+    EXPECT_EQ(records[13].id, records[3].id);
+    EXPECT_EQ(records[13].size, 16u);
+    /* The moved handle block is released under the handle it got */
+    EXPECT_EQ(records[14].op, (uint32_t)SMEM_TRACE_FREE);
+    EXPECT_EQ(records[14].old_id, records[1].id);
+    EXPECT_EQ(unmatched(records), 0u);
+}
+
+TEST_F(SmallMemTraceTest, open_test)
+{
+    struct small_mem_trace trace;
+    struct smem_trace_header header;
+    std::vector<struct smem_trace_record> records;
+
+    /* A file which is still recording does not pass for a trace */
+    ASSERT_EQ(smem_trace_start(&trace, heap, path.c_str(), 16), 0);
+    smem_free(smem_alloc(heap, 32));
+    ASSERT_TRUE(load_header(&header));
+    EXPECT_EQ(header.magic, (uint32_t)SMEM_TRACE_MAGIC_OPEN);
+    EXPECT_EQ(smem_trace_stop(&trace), 2u);
+    ASSERT_TRUE(load(&header, records));
+    EXPECT_EQ(header.magic, (uint32_t)SMEM_TRACE_MAGIC);
+}
+
+#if SMEM_USING_THREAD_SAFE
+#define TEST_TRACE_THREADS 4
+#define TEST_TRACE_LOOP 2000
+
+TEST_F(SmallMemTraceTest, thread_test)
+{
+    struct small_mem_trace trace;
+    struct smem_trace_header header;
+    std::vector<struct smem_trace_record> records;
+    std::vector<std::thread> threads;
+
+    /* Blocks freed by one thread are taken by another, a free must come first in the trace */
+    ASSERT_EQ(smem_trace_start(&trace, heap, path.c_str(), TEST_TRACE_THREADS * TEST_TRACE_LOOP * 2), 0);
+    for (int t = 0; t < TEST_TRACE_THREADS; t++)
+    {
+        threads.emplace_back([this, t]() {
+            void *ptr[4] = {nullptr, nullptr, nullptr, nullptr};
+
+            for (int i = 0; i < TEST_TRACE_LOOP; i++)
+            {
+                int slot = (i + t) % 4;
+
+                if (ptr[slot] != nullptr)
+                    smem_free(ptr[slot]);
+                ptr[slot] = smem_alloc(heap, 16 + (size_t)((i * 7 + t) % 8) * 16);
+            }
+            for (int slot = 0; slot < 4; slot++)
+                smem_free(ptr[slot]);
+            smem_tcache_flush();
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    EXPECT_GT(smem_trace_stop(&trace), 0u);
+
+    ASSERT_TRUE(load(&header, records));
+    EXPECT_EQ(header.dropped, 0u);
+    EXPECT_EQ(unmatched(records), 0u);
+}
+#endif
+
+TEST_F(SmallMemTraceTest, full_test)
+{
+    struct small_mem_trace trace;
+    struct smem_trace_header header;
+    std::vector<struct smem_trace_record> records;
+    int i;
+
+    /* Operations past the capacity are counted as dropped */
+    ASSERT_EQ(smem_trace_start(&trace, heap, path.c_str(), 4), 0);
+    for (i = 0; i < 5; i++)
+        smem_free(smem_alloc(heap, 32));
+    EXPECT_EQ(smem_trace_stop(&trace), 4u);
+    ASSERT_TRUE(load(&header, records));
+    EXPECT_EQ(header.count, 4u);
+    EXPECT_EQ(header.dropped, 6u);
+    /* An unusable path fails */
+    EXPECT_EQ(smem_trace_start(&trace, heap, "/nonexistent/smem_trace.bin", 4), -1);
+}
+
+#endif